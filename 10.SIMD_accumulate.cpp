@@ -0,0 +1,317 @@
+#include <thread>
+#include <iostream>
+#include <future>
+#include <vector>
+#include <numeric>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ACCUM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+/*
+	accum() from 6.Sharing_data_between_threads.cpp BLK4 is just:
+		return std::accumulate(beg, end, init);
+
+	Looks innocent, but every add depends on the result of the previous add:
+		acc = ((((init + a0) + a1) + a2) + a3) ...
+	One add has ~4 cycles latency, so the core does one add every 4 cycles, and the SIMD units do nothing.
+	The compiler is NOT allowed to reorder it for us, because floating point add is not associative
+	( that's what -ffast-math would allow, and we don't want that globally ).
+
+	So we reorder it ourselves:
+		1. several independent accumulators => several adds in flight at the same time
+		2. each accumulator is a SIMD register => 2 ( SSE2 ), 4 ( AVX2 ) or 8 ( AVX-512 ) doubles per add
+		3. pick the best kernel at runtime, so one binary runs on every x86 box we own
+
+	Be aware: a different order means slightly different rounding.
+	Each kernel always gives the same answer for the same input, but the AVX2 answer may differ from the SSE2
+	answer in the last bits. If that matters, use the Kahan or pairwise versions in BLK1, they are much closer to
+	the exact sum than std::accumulate ever was.
+*/
+
+// Kernels and runtime dispatch //
+#define BLK1
+
+// Plug the kernels into the packaged_task split from note 6 BLK4, with a benchmark ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+
+// gcc and clang can compile one function for AVX2 without compiling the whole file with -mavx2//
+// MSVC lets you use the intrinsics anywhere, so the attribute is just empty there//
+#if defined(ACCUM_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+using accum_fn = double (*)(double const*, double const*, double);
+
+// Plain C++, 4 independent accumulators. The baseline for non-x86 CPUs//
+double accum_scalar4(double const* beg, double const* end, double init) {
+	double a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+	for (; end - beg >= 4; beg += 4) {
+		a0 += beg[0];
+		a1 += beg[1];
+		a2 += beg[2];
+		a3 += beg[3];
+	}
+	for (; beg != end; ++beg) {
+		a0 += *beg;
+	}
+	return init + ((a0 + a1) + (a2 + a3));
+}
+
+#ifdef ACCUM_X86
+// SSE2 is part of x86-64, so this one is always there//
+// 4 registers x 2 doubles = 8 adds in flight//
+double accum_sse2(double const* beg, double const* end, double init) {
+	__m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd(), a2 = _mm_setzero_pd(), a3 = _mm_setzero_pd();
+	for (; end - beg >= 8; beg += 8) {
+		a0 = _mm_add_pd(a0, _mm_loadu_pd(beg));
+		a1 = _mm_add_pd(a1, _mm_loadu_pd(beg + 2));
+		a2 = _mm_add_pd(a2, _mm_loadu_pd(beg + 4));
+		a3 = _mm_add_pd(a3, _mm_loadu_pd(beg + 6));
+	}
+	__m128d const s = _mm_add_pd(_mm_add_pd(a0, a1), _mm_add_pd(a2, a3));
+	double lanes[2];
+	_mm_storeu_pd(lanes, s);
+	return accum_scalar4(beg, end, init + (lanes[0] + lanes[1]));
+}
+
+// 4 registers x 4 doubles = 16 adds in flight//
+TARGET_AVX2 double accum_avx2(double const* beg, double const* end, double init) {
+	__m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd(), a2 = _mm256_setzero_pd(), a3 = _mm256_setzero_pd();
+	for (; end - beg >= 16; beg += 16) {
+		a0 = _mm256_add_pd(a0, _mm256_loadu_pd(beg));
+		a1 = _mm256_add_pd(a1, _mm256_loadu_pd(beg + 4));
+		a2 = _mm256_add_pd(a2, _mm256_loadu_pd(beg + 8));
+		a3 = _mm256_add_pd(a3, _mm256_loadu_pd(beg + 12));
+	}
+	__m256d const s = _mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3));
+	double lanes[4];
+	_mm256_storeu_pd(lanes, s);
+	return accum_scalar4(beg, end, init + ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])));
+}
+
+// 4 registers x 8 doubles = 32 adds in flight//
+TARGET_AVX512 double accum_avx512(double const* beg, double const* end, double init) {
+	__m512d a0 = _mm512_setzero_pd(), a1 = _mm512_setzero_pd(), a2 = _mm512_setzero_pd(), a3 = _mm512_setzero_pd();
+	for (; end - beg >= 32; beg += 32) {
+		a0 = _mm512_add_pd(a0, _mm512_loadu_pd(beg));
+		a1 = _mm512_add_pd(a1, _mm512_loadu_pd(beg + 8));
+		a2 = _mm512_add_pd(a2, _mm512_loadu_pd(beg + 16));
+		a3 = _mm512_add_pd(a3, _mm512_loadu_pd(beg + 24));
+	}
+	__m512d const s = _mm512_add_pd(_mm512_add_pd(a0, a1), _mm512_add_pd(a2, a3));
+	double lanes[8];
+	_mm512_storeu_pd(lanes, s);
+	double const total = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+	return accum_scalar4(beg, end, init + total);
+}
+
+/*
+	Kahan summation keeps the rounding error of every add in a second variable c, and feeds it back.
+	The vector version just runs 4 independent Kahan sums, one per lane.
+	( This only works WITHOUT -ffast-math, fast-math "optimizes" (t - sum) - y to zero )
+*/
+TARGET_AVX2 double accum_kahan_avx2(double const* beg, double const* end, double init) {
+	__m256d sum = _mm256_setzero_pd(), c = _mm256_setzero_pd();
+	for (; end - beg >= 4; beg += 4) {
+		__m256d const y = _mm256_sub_pd(_mm256_loadu_pd(beg), c);
+		__m256d const t = _mm256_add_pd(sum, y);
+		c = _mm256_sub_pd(_mm256_sub_pd(t, sum), y);
+		sum = t;
+	}
+	double s[4], e[4];
+	_mm256_storeu_pd(s, sum);
+	_mm256_storeu_pd(e, c);
+	// Fold the lanes with the scalar Kahan below, errors included//
+	double acc = init, comp = 0.0;
+	auto add = [&acc, &comp](double v) {
+		double const y = v - comp;
+		double const t = acc + y;
+		comp = (t - acc) - y;
+		acc = t;
+	};
+	for (int i = 0; i < 4; ++i) {
+		add(s[i]);
+		add(-e[i]);
+	}
+	for (; beg != end; ++beg) {
+		add(*beg);
+	}
+	return acc;
+}
+#endif // ACCUM_X86
+
+double accum_kahan_scalar(double const* beg, double const* end, double init) {
+	double sum = init, c = 0.0;
+	for (; beg != end; ++beg) {
+		double const y = *beg - c;
+		double const t = sum + y;
+		c = (t - sum) - y;
+		sum = t;
+	}
+	return sum;
+}
+
+/*
+	The CPU check.
+	gcc/clang have __builtin_cpu_supports, on MSVC we ask cpuid ourselves.
+	For AVX we also need the OS to save the big registers on context switch ( the xgetbv check ).
+*/
+struct cpu_features {
+	bool avx2 = false;
+	bool avx512f = false;
+	cpu_features() {
+#if defined(ACCUM_X86) && (defined(__GNUC__) || defined(__clang__))
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		avx512f = __builtin_cpu_supports("avx512f");
+#elif defined(ACCUM_X86) && defined(_MSC_VER)
+		int r[4];
+		__cpuid(r, 1);
+		bool const osxsave = (r[2] & (1 << 27)) != 0;
+		bool const fma = (r[2] & (1 << 12)) != 0;
+		unsigned long long const xcr0 = osxsave ? _xgetbv(0) : 0;
+		__cpuidex(r, 7, 0);
+		avx2 = fma && (r[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+		avx512f = (r[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+#endif
+	}
+};
+
+cpu_features const& cpu() {
+	static cpu_features const features;
+	return features;
+}
+
+// Picked once, the first time somebody asks//
+accum_fn best_accum_kernel() {
+#ifdef ACCUM_X86
+	if (cpu().avx512f)
+		return accum_avx512;
+	if (cpu().avx2)
+		return accum_avx2;
+	return accum_sse2;
+#else
+	return accum_scalar4;
+#endif
+}
+
+accum_fn best_kahan_kernel() {
+#ifdef ACCUM_X86
+	if (cpu().avx2)
+		return accum_kahan_avx2;
+#endif
+	return accum_kahan_scalar;
+}
+
+/*
+	Pairwise summation: split in half, sum each half, add the two.
+	The error grows with log(n) instead of n, and the leaves still run the fast SIMD kernel,
+	so it is only a little slower than the plain SIMD sum.
+*/
+double accum_pairwise(double const* beg, double const* end, double init) {
+	static accum_fn const leaf = best_accum_kernel();
+	constexpr std::ptrdiff_t leaf_size = 8192;
+	std::ptrdiff_t const n = end - beg;
+	if (n <= leaf_size)
+		return leaf(beg, end, init);
+	double const* mid = beg + n / 2;
+	return init + (accum_pairwise(beg, mid, 0.0) + accum_pairwise(mid, end, 0.0));
+}
+
+/*
+	Same signature as accum() in note 6 BLK4, so it drops straight into
+		std::packaged_task<double(double*, double*, double)>
+*/
+double accum(double* beg, double* end, double init) {
+	static accum_fn const kernel = best_accum_kernel();
+	return kernel(beg, end, init);
+}
+
+double accum_kahan(double* beg, double* end, double init) {
+	static accum_fn const kernel = best_kahan_kernel();
+	return kernel(beg, end, init);
+}
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	The split is the same as note 6 BLK4, only the function inside the packaged_task changed.
+	Then each kernel runs single threaded, to see how far it is from the memory bandwidth.
+*/
+double accum_std(double* beg, double* end, double init) {
+	return std::accumulate(beg, end, init);
+}
+
+double split_in_two(double (*fn)(double*, double*, double), std::vector<double>& vec) {
+	double* first = &vec[0];
+	double* half = first + vec.size() / 2;
+	double* last = first + vec.size();
+	std::packaged_task<double(double*, double*, double)> pt1(fn);
+	std::packaged_task<double(double*, double*, double)> pt2(fn);
+	auto f1 = pt1.get_future();
+	auto f2 = pt2.get_future();
+	std::thread t1(std::move(pt1), first, half, 0.0);
+	std::thread t2(std::move(pt2), half, last, 0.0);
+	double result = f1.get() + f2.get();
+	t1.join();
+	t2.join();
+	return result;
+}
+
+template <typename Fn>
+void bench(char const* name, Fn fn, std::vector<double>& vec, double exact) {
+	constexpr int rounds = 10;
+	double result = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; ++i) {
+		result = fn(vec.data(), vec.data() + vec.size(), 0.0);
+	}
+	std::chrono::duration<double> const secs = std::chrono::steady_clock::now() - start;
+	double const gbs = rounds * vec.size() * sizeof(double) / secs.count() / 1e9;
+	std::cout << name << "\t" << gbs << " GB/s\terror " << std::fabs(result - exact) << "\n";
+}
+
+int main() {
+	std::cout << "avx2: " << cpu().avx2 << ", avx512f: " << cpu().avx512f << "\n";
+
+	// 0.1 is not exact in binary, so the error actually shows up//
+	std::vector<double> vec(10000000, 0.1);
+	double const exact = 1000000.0;
+
+	std::cout.precision(6);
+	bench("std::accumulate", [](double const* b, double const* e, double i) {return std::accumulate(b, e, i); }, vec, exact);
+	bench("scalar x4     ", accum_scalar4, vec, exact);
+#ifdef ACCUM_X86
+	bench("sse2          ", accum_sse2, vec, exact);
+	if (cpu().avx2)
+		bench("avx2          ", accum_avx2, vec, exact);
+	if (cpu().avx512f)
+		bench("avx512        ", accum_avx512, vec, exact);
+#endif
+	bench("dispatched    ", accum, vec, exact);
+	bench("kahan         ", accum_kahan, vec, exact);
+	bench("pairwise      ", accum_pairwise, vec, exact);
+
+	std::cout.precision(17);
+	std::cout << "packaged_task split, std::accumulate: " << split_in_two(accum_std, vec) << "\n";
+	std::cout << "packaged_task split, simd accum:      " << split_in_two(accum, vec) << "\n";
+	std::cout << "packaged_task split, kahan:           " << split_in_two(accum_kahan, vec) << std::endl;
+}
+
+#endif // BLK2
@@ -0,0 +1,153 @@
+#include <thread>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstddef>
+#include <algorithm>
+/*
+	Two counters we have seen so far:
+		4.Data_Race_Mutex.cpp BLK2				=> four funcA threads doing x++ on an int under one mutex mu
+		7.Atomic_and_multi_threading.cpp BLK1	=> three threads doing x_int++ on one std::atomic<int>
+
+	Both are correct. Both are slow when many threads count at the same time, and the reason is the same:
+	there is ONE cache line, and every increment needs that line in exclusive mode in its own core's cache.
+	So the line bounces from core to core ( "cache line ping-pong" ), and every increment waits for the bounce.
+	With the mutex it is even worse, the mutex itself is another bouncing line, and waiters may go to sleep.
+
+	Remember "sharing less" from the atomic note? That's the fix:
+		give every thread its own slot ( on its own cache line ), and only add the slots up when somebody reads.
+
+	Writes are cheap and never contend, reads are a bit more expensive ( they touch every slot ).
+	That is exactly what a metrics counter wants: incremented millions of times, read once a second.
+*/
+
+// sharded_counter //
+#define BLK1
+
+// Benchmark against the mutex counter and the single atomic counter ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+/*
+	A slot per thread would need to know how many threads there will be.
+	So we make (at least) one slot per hardware thread and map threads onto the slots round robin.
+	Two threads may share a slot, which is why the slot is still an atomic, but with memory_order_relaxed
+	and ( usually ) nobody else touching the line, fetch_add is about as cheap as a plain add.
+
+	read() is NOT a snapshot of one instant: while we walk the slots, the others keep counting.
+	It is exact once the writers are done ( after join ), and never loses or doubles an increment.
+*/
+class sharded_counter {
+	// One slot per cache line, so two slots never false-share//
+	struct alignas(64) slot {
+		std::atomic<long long> value{ 0 };
+	};
+
+	std::size_t const mask;
+	std::unique_ptr<slot[]> slots;
+
+	static std::size_t round_up_pow2(std::size_t n) {
+		std::size_t p = 1;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+
+	// Every thread gets a number the first time it counts, 0, 1, 2, ...//
+	static std::size_t thread_index() {
+		static std::atomic<std::size_t> next{ 0 };
+		thread_local std::size_t const index = next.fetch_add(1, std::memory_order_relaxed);
+		return index;
+	}
+
+public:
+	explicit sharded_counter(std::size_t shards = std::thread::hardware_concurrency())
+		: mask(round_up_pow2(shards == 0 ? 1 : shards) - 1), slots(new slot[mask + 1]) {}
+	// Not copyable, just like the std::atomic it replaces//
+	sharded_counter(sharded_counter const&) = delete;
+	sharded_counter& operator=(sharded_counter const&) = delete;
+
+	void add(long long n = 1) {
+		slots[thread_index() & mask].value.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	long long read() const {
+		long long sum = 0;
+		for (std::size_t i = 0; i <= mask; ++i) {
+			sum += slots[i].value.load(std::memory_order_relaxed);
+		}
+		return sum;
+	}
+
+	std::size_t shards() const { return mask + 1; }
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	Every thread does increments_per_thread increments, one at a time, like a metrics counter would.
+		mutex		=> lock_guard around x++ ( 4.Data_Race_Mutex.cpp BLK2, but per increment instead of per loop )
+		atomic		=> x_int++ ( 7.Atomic_and_multi_threading.cpp BLK1 )
+		sharded		=> counter.add()
+
+	( 4.Data_Race_Mutex.cpp BLK2 locks around the whole for loop. That's correct, but then the four threads just run
+	  one after another, there is no concurrency left to measure. )
+*/
+constexpr int increments_per_thread = 1000000;
+
+template <typename Fn>
+double run(int thread_count, Fn increment) {
+	std::vector<std::thread> thread_vec{};
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < thread_count; i++) {
+		thread_vec.push_back(std::thread([&increment]() {
+			for (int n = 0; n < increments_per_thread; ++n) {
+				increment();
+			}
+		}));
+	}
+	for (std::thread& t : thread_vec) {
+		t.join();
+	}
+	std::chrono::duration<double> const secs = std::chrono::steady_clock::now() - start;
+	// million increments per second//
+	return thread_count * static_cast<double>(increments_per_thread) / secs.count() / 1e6;
+}
+
+int main() {
+	unsigned const cores = std::max(1u, std::thread::hardware_concurrency());
+	std::cout << "threads\tmutex\tatomic\tsharded (M increments/s)\n";
+	for (unsigned thread_count = 1; thread_count <= cores * 2; thread_count *= 2) {
+		long long x = 0;
+		std::mutex mu;
+		double const mutex_rate = run(thread_count, [&]() {
+			std::lock_guard guard1(mu);
+			x++;
+		});
+
+		std::atomic<long long> x_int(0);
+		double const atomic_rate = run(thread_count, [&]() {
+			x_int++;
+		});
+
+		sharded_counter counter;
+		double const sharded_rate = run(thread_count, [&]() {
+			counter.add();
+		});
+
+		long long const expected = static_cast<long long>(thread_count) * increments_per_thread;
+		if (x != expected || x_int != expected || counter.read() != expected) {
+			std::cerr << "lost an increment!!!\n";
+		}
+		std::cout << thread_count << "\t" << mutex_rate << "\t" << atomic_rate << "\t" << sharded_rate << "\n";
+	}
+}
+
+#endif // BLK2
@@ -0,0 +1,352 @@
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <latch>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <mutex>
+#include <cstdint>
+#include <functional>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+/*
+	7.Atomic_and_multi_threading.cpp lists the six std::memory_order values, and explains the
+	compare_exchange_strong retry loop:
+		auto old_val = g_atomicX.load();
+		while(!g_atomicX.compare_exchange_strong(old_val,f(oldX)));
+
+	Lots of words there, zero numbers.
+	Before anybody relaxes an ordering in production "because it is faster", let's measure how much faster.
+
+	What we measure:
+		1. the update:   fetch_add   vs   CAS loop with compare_exchange_strong   vs   CAS loop with compare_exchange_weak
+		2. the ordering: relaxed, acq_rel, seq_cst
+		3. the threads:  1, 2, 4, ... up to every core
+	And for each one:
+		throughput ( million updates per second over all threads )
+		p50 / p99 latency of a single update
+
+	How to read the numbers:
+		On x86 every read-modify-write is a locked instruction, which is already a full barrier.
+		So relaxed vs seq_cst fetch_add usually costs the same there, and the thread count matters way more.
+		On ARM the orderings really are different instructions, so measure on the machine you ship on.
+*/
+
+// The harness //
+#define BLK1
+
+// The fetch_add / CAS x memory order matrix ( needs BLK1 ) //
+//#define BLK2
+
+// atomic_update: CAS loop with backoff, lock fallback and retry counting ( needs BLK1 ) //
+#define BLK3
+
+
+#ifdef BLK1
+/*
+	The updates, same as in note 7:
+		incrementer()	=> x_int++, which is fetch_add with seq_cst
+		faa()			=> a + 10, applied with a CAS loop
+*/
+int faa(int const& a) {
+	return a + 10;
+}
+
+enum class update_kind { fetch_add, cas_strong, cas_weak };
+
+// A CAS that fails did not write anything, so it can't be release. Pick the strongest legal failure order//
+constexpr std::memory_order failure_order(std::memory_order order) {
+	return order == std::memory_order_acq_rel ? std::memory_order_acquire
+		: order == std::memory_order_release ? std::memory_order_relaxed
+		: order;
+}
+
+template <update_kind Kind, std::memory_order Order>
+void update(std::atomic<int>& x) {
+	if constexpr (Kind == update_kind::fetch_add) {
+		x.fetch_add(10, Order);
+	}
+	else if constexpr (Kind == update_kind::cas_strong) {
+		int old_val = x.load(std::memory_order_relaxed);
+		while (!x.compare_exchange_strong(old_val, faa(old_val), Order, failure_order(Order)));
+	}
+	else {
+		// weak may fail even when old_val matched ( spurious failure ), but inside a loop we retry anyway//
+		// and on LL/SC machines ( ARM ) it saves an inner loop//
+		int old_val = x.load(std::memory_order_relaxed);
+		while (!x.compare_exchange_weak(old_val, faa(old_val), Order, failure_order(Order)));
+	}
+}
+
+struct result {
+	double mops;
+	double p50_ns;
+	double p99_ns;
+};
+
+constexpr int ops_per_thread = 200000;
+// Timing every single update would measure the clock more than the update, so we time every 16th one//
+constexpr int sample_every = 16;
+
+// What does steady_clock::now() itself cost? We take that off the samples//
+double clock_overhead_ns() {
+	constexpr int n = 10000;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < n; ++i) {
+		auto volatile t = std::chrono::steady_clock::now();
+		(void)t;
+	}
+	std::chrono::duration<double, std::nano> const d = std::chrono::steady_clock::now() - start;
+	return d.count() / n;
+}
+
+template <typename Op>
+result measure(unsigned thread_count, Op op) {
+	static double const overhead = clock_overhead_ns();
+	std::atomic<int> x{ 0 };
+	std::vector<std::vector<double>> samples(thread_count);
+	std::vector<double> seconds(thread_count);
+	// All threads start at the same time, otherwise thread 1 finishes before thread 8 is even created//
+	std::latch start_line(thread_count);
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < thread_count; ++t) {
+		threads.emplace_back([&, t]() {
+			std::vector<double>& mine = samples[t];
+			mine.reserve(ops_per_thread / sample_every);
+			start_line.arrive_and_wait();
+			auto const begin = std::chrono::steady_clock::now();
+			for (int i = 0; i < ops_per_thread; ++i) {
+				if (i % sample_every == 0) {
+					auto const t0 = std::chrono::steady_clock::now();
+					op(x);
+					std::chrono::duration<double, std::nano> const d = std::chrono::steady_clock::now() - t0;
+					mine.push_back(std::max(0.0, d.count() - overhead));
+				}
+				else {
+					op(x);
+				}
+			}
+			seconds[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		});
+	}
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	if (x.load() != static_cast<int>(thread_count * ops_per_thread * 10)) {
+		std::cerr << "lost an update!!!\n";
+	}
+
+	std::vector<double> all;
+	for (auto& s : samples) {
+		all.insert(all.end(), s.begin(), s.end());
+	}
+	auto percentile = [&all](double p) {
+		auto const k = static_cast<std::size_t>(p * static_cast<double>(all.size() - 1));
+		std::nth_element(all.begin(), all.begin() + static_cast<std::ptrdiff_t>(k), all.end());
+		return all[k];
+	};
+	double const slowest = *std::max_element(seconds.begin(), seconds.end());
+	return { thread_count * static_cast<double>(ops_per_thread) / slowest / 1e6, percentile(0.50), percentile(0.99) };
+}
+
+std::vector<unsigned> thread_counts() {
+	unsigned const cores = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> counts;
+	for (unsigned n = 1; n < cores; n *= 2) {
+		counts.push_back(n);
+	}
+	counts.push_back(cores);
+	return counts;
+}
+
+void print_row(std::string const& name, unsigned threads, result const& r) {
+	std::cout << std::left << std::setw(28) << name << std::right << std::setw(8) << threads
+		<< std::setw(12) << std::fixed << std::setprecision(2) << r.mops
+		<< std::setw(10) << std::setprecision(1) << r.p50_ns
+		<< std::setw(10) << r.p99_ns << "\n";
+}
+
+void print_header() {
+	std::cout << std::left << std::setw(28) << "update / order" << std::right << std::setw(8) << "threads"
+		<< std::setw(12) << "Mops/s" << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns" << "\n";
+}
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+template <update_kind Kind, std::memory_order Order>
+void run_row(std::string const& name) {
+	for (unsigned threads : thread_counts()) {
+		print_row(name, threads, measure(threads, update<Kind, Order>));
+	}
+}
+
+int main() {
+	print_header();
+
+	run_row<update_kind::fetch_add, std::memory_order_relaxed>("fetch_add relaxed");
+	run_row<update_kind::fetch_add, std::memory_order_acq_rel>("fetch_add acq_rel");
+	run_row<update_kind::fetch_add, std::memory_order_seq_cst>("fetch_add seq_cst");
+
+	run_row<update_kind::cas_strong, std::memory_order_relaxed>("cas_strong relaxed");
+	run_row<update_kind::cas_strong, std::memory_order_acq_rel>("cas_strong acq_rel");
+	run_row<update_kind::cas_strong, std::memory_order_seq_cst>("cas_strong seq_cst");
+
+	run_row<update_kind::cas_weak, std::memory_order_relaxed>("cas_weak relaxed");
+	run_row<update_kind::cas_weak, std::memory_order_acq_rel>("cas_weak acq_rel");
+	run_row<update_kind::cas_weak, std::memory_order_seq_cst>("cas_weak seq_cst");
+}
+
+#endif // BLK2
+
+
+
+#ifdef BLK3
+/*
+	The retry loop from note 7 has no brakes:
+		while(!g_atomicX.compare_exchange_strong(old_val,f(oldX)));
+	With many writers, every failed CAS immediately tries again. All of them keep pulling the cache line to their
+	own core, so the one that could succeed keeps losing the line. Lots of traffic, very little progress.
+	( Like 10 people trying to walk through one door at the same time, and all of them stepping back and
+	  forward again right away )
+
+	atomic_update(x, f) fixes that:
+		1. compare_exchange_weak, we are in a loop anyway
+		2. after a failure, spin a little with the pause instruction before retrying
+		3. the spin doubles after each failure ( exponential backoff ), up to max_spins, with some randomness
+		   so the threads don't retry in lock step
+		4. after lock_after failures, take a lock and keep trying under it.
+		   The lock doesn't protect x ( the other threads still CAS without it ), it just lets
+		   only ONE of the unlucky threads keep fighting, so the line stops bouncing between all of them.
+		5. it returns how many retries it took, and can add them to a contention_stats, so we can SEE the contention.
+
+	f must be a pure function of the old value ( it may be called many times, same rule as the wait() lambda in note 6 ).
+*/
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+struct backoff_policy {
+	unsigned min_spins = 4;
+	unsigned max_spins = 1024;
+	// 0 => never fall back to the lock//
+	unsigned lock_after = 0;
+};
+
+// Shared by every atomic_update call, read it whenever you like//
+// Only updates that had to retry touch it, so an uncontended update doesn't pay for the bookkeeping//
+struct contention_stats {
+	std::atomic<std::uint64_t> contended_updates{ 0 };
+	std::atomic<std::uint64_t> retries{ 0 };
+	std::atomic<std::uint64_t> lock_fallbacks{ 0 };
+};
+
+template <typename T>
+struct update_result {
+	T previous;
+	T desired;
+	unsigned retries;
+	bool used_lock;
+};
+
+/*
+	We only get a std::atomic<T>&, there is no mutex next to it.
+	So the fallback lock comes from a small table, picked by the address of the atomic.
+	( libatomic does the same thing for the atomics that are too big to be lock free )
+*/
+inline std::mutex& fallback_lock_for(void const* address) {
+	struct alignas(64) padded_mutex {
+		std::mutex m;
+	};
+	static padded_mutex table[64];
+	auto const h = reinterpret_cast<std::uintptr_t>(address) >> 6;
+	return table[h % 64].m;
+}
+
+template <typename T, typename F>
+update_result<T> atomic_update(std::atomic<T>& x, F f, backoff_policy const& policy = {},
+	contention_stats* stats = nullptr) {
+	thread_local std::uint32_t rng = 0x9E3779B9u ^ static_cast<std::uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+	unsigned retries = 0;
+	unsigned spins = policy.min_spins;
+	std::unique_lock<std::mutex> fallback;
+
+	T old_val = x.load(std::memory_order_relaxed);
+	T desired = f(old_val);
+	while (!x.compare_exchange_weak(old_val, desired, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+		++retries;
+		if (policy.lock_after != 0 && retries == policy.lock_after) {
+			fallback = std::unique_lock<std::mutex>(fallback_lock_for(&x));
+			// We waited on the lock, that was our backoff. Start fresh//
+			spins = policy.min_spins;
+			old_val = x.load(std::memory_order_relaxed);
+		}
+		else {
+			// xorshift, cheap randomness for the jitter//
+			rng ^= rng << 13;
+			rng ^= rng >> 17;
+			rng ^= rng << 5;
+			unsigned const n = spins / 2 + rng % (spins / 2 + 1);
+			for (unsigned i = 0; i < n; ++i) {
+				cpu_relax();
+			}
+			spins = std::min(spins * 2, policy.max_spins);
+			// The failed CAS already loaded the current value into old_val, but we slept since then//
+			old_val = x.load(std::memory_order_relaxed);
+		}
+		desired = f(old_val);
+	}
+
+	bool const used_lock = fallback.owns_lock();
+	if (stats && retries != 0) {
+		stats->contended_updates.fetch_add(1, std::memory_order_relaxed);
+		stats->retries.fetch_add(retries, std::memory_order_relaxed);
+		if (used_lock)
+			stats->lock_fallbacks.fetch_add(1, std::memory_order_relaxed);
+	}
+	return { old_val, desired, retries, used_lock };
+}
+
+/*
+	Same harness as BLK2, with faa() from note 7:
+		the bare cas_strong / cas_weak loops from BLK1
+		atomic_update with backoff
+		atomic_update with backoff and lock fallback after 8 failures
+*/
+int main() {
+	print_header();
+	for (unsigned threads : thread_counts()) {
+		print_row("bare cas_strong", threads, measure(threads, update<update_kind::cas_strong, std::memory_order_acq_rel>));
+		print_row("bare cas_weak", threads, measure(threads, update<update_kind::cas_weak, std::memory_order_acq_rel>));
+
+		contention_stats backoff_stats;
+		print_row("atomic_update backoff", threads, measure(threads, [&](std::atomic<int>& x) {
+			atomic_update(x, faa, backoff_policy{}, &backoff_stats);
+		}));
+
+		contention_stats lock_stats;
+		backoff_policy with_lock;
+		with_lock.lock_after = 8;
+		print_row("atomic_update backoff+lock", threads, measure(threads, [&](std::atomic<int>& x) {
+			atomic_update(x, faa, with_lock, &lock_stats);
+		}));
+
+		double const updates = threads * static_cast<double>(ops_per_thread);
+		std::cout << "    retries per update: backoff " << std::setprecision(4)
+			<< static_cast<double>(backoff_stats.retries) / updates
+			<< ", backoff+lock " << static_cast<double>(lock_stats.retries) / updates
+			<< " ( " << lock_stats.lock_fallbacks << " lock fallbacks )\n";
+	}
+}
+
+#endif // BLK3
@@ -0,0 +1,221 @@
+#include <thread>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+/*
+	Look at the critical sections we wrote in the mutex notes:
+		4.Data_Race_Mutex.cpp BLK2		=> x++ under mu
+		5.Dead_Lock_Mutex.cpp BLK7		=> return some_detail; under m
+	A few instructions each. But std::mutex doesn't know that.
+
+	When std::mutex is taken, the thread asking for it ( pretty much ) goes to sleep in the kernel right away,
+	and the owner has to make a syscall to wake it up. Sleeping + waking up costs microseconds,
+	the critical section costs nanoseconds. ( Like calling a taxi to cross the street )
+
+	A spin lock is the other extreme: never sleep, just keep trying.
+	Great when the owner is about to let go, terrible when the owner got descheduled ( you spin for a whole time slice ).
+
+	The adaptive ( hybrid ) mutex does both:
+		1. try to grab it
+		2. spin for a short while, with pause and exponential backoff, hoping the owner lets go soon
+		3. if not, go to sleep on a futex ( std::atomic::wait in C++20 ), like std::mutex would
+
+	It has lock(), try_lock() and unlock(), which makes it "Lockable".
+	So std::lock_guard, std::scoped_lock, std::unique_lock and std::lock() all work with it, no changes needed.
+*/
+
+// adaptive_mutex //
+#define BLK1
+
+// Benchmark on the blocks from note 4 and note 5 ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+/*
+	The state is the classic futex mutex from Ulrich Drepper's "Futexes Are Tricky":
+		0 => unlocked
+		1 => locked, nobody sleeping
+		2 => locked, maybe somebody sleeping
+	unlock() only makes the notify call ( a syscall ) when the state was 2.
+	So when there is no contention, lock + unlock is just two atomic instructions, no kernel at all.
+*/
+class adaptive_mutex {
+	std::atomic<std::uint32_t> state{ 0 };
+
+	static constexpr int spin_rounds = 10;
+	static constexpr unsigned max_pause = 64;
+
+	void lock_slow() {
+		// Spin: only look at the state ( plain loads keep the cache line shared ), CAS when it looks free//
+		unsigned pause = 1;
+		for (int round = 0; round < spin_rounds; ++round) {
+			for (unsigned i = 0; i < pause; ++i) {
+				cpu_relax();
+			}
+			pause = pause < max_pause ? pause * 2 : max_pause;
+			std::uint32_t expected = 0;
+			if (state.load(std::memory_order_relaxed) == 0 &&
+				state.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+				return;
+		}
+		// Park: mark the mutex as "has sleepers" and sleep until it changes.//
+		// If exchange returns 0, we got the lock ( in state 2, so our unlock may wake somebody for nothing, that's fine )//
+		while (state.exchange(2, std::memory_order_acquire) != 0) {
+			state.wait(2, std::memory_order_relaxed);
+		}
+	}
+
+public:
+	adaptive_mutex() = default;
+	// Just like std::mutex, not copyable, not moveable//
+	adaptive_mutex(adaptive_mutex const&) = delete;
+	adaptive_mutex& operator=(adaptive_mutex const&) = delete;
+
+	void lock() {
+		std::uint32_t expected = 0;
+		if (state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+			return;
+		lock_slow();
+	}
+
+	bool try_lock() {
+		std::uint32_t expected = 0;
+		return state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void unlock() {
+		if (state.exchange(0, std::memory_order_release) == 2)
+			state.notify_one();
+	}
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	Block 1: funcA from 4.Data_Race_Mutex.cpp BLK2, four threads.
+		BLK2 there locks around the whole loop, which means one lock per thread. Nothing to measure.
+		So here each x++ takes the lock, which is what a real short critical section looks like.
+
+	Block 2: Y from 5.Dead_Lock_Mutex.cpp BLK7, templated on the mutex type.
+		Four threads keep calling operator== on two shared Y objects.
+		get_detail() uses lock_guard, operator== uses scoped_lock and unique_lock versions too,
+		to prove all three RAII wrappers work with adaptive_mutex.
+*/
+constexpr int increments_per_thread = 1000000;
+constexpr int compares_per_thread = 500000;
+
+template <typename Mutex>
+double funcA_block() {
+	int x = 0;
+	Mutex mu;
+	auto funcA = [&x, &mu]() {
+		for (int i = 0; i < increments_per_thread; ++i) {
+			std::lock_guard guard1(mu);
+			x++;
+		}
+	};
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> thread_vec{};
+	for (size_t i = 0; i < 4; i++) {
+		thread_vec.push_back(std::thread(funcA));
+	}
+	for (std::thread& t : thread_vec) {
+		t.join();
+	}
+	std::chrono::duration<double, std::milli> const ms = std::chrono::steady_clock::now() - start;
+	if (x != 4 * increments_per_thread)
+		std::cerr << "data race!!!\n";
+	return ms.count();
+}
+
+template <typename Mutex>
+class Y {
+private:
+	int some_detail;
+	mutable Mutex m;
+	int get_detail() const
+	{
+		std::lock_guard<Mutex> lock_a(m);
+		return some_detail;
+	}
+public:
+	Y(int sd) :some_detail(sd) {}
+	void set_detail(int sd) {
+		std::unique_lock<Mutex> lk(m);
+		some_detail = sd;
+	}
+	friend bool operator==(Y const& lhs, Y const& rhs)
+	{
+		if (&lhs == &rhs)
+			return true;
+		int const lhs_value = lhs.get_detail();
+		int const rhs_value = rhs.get_detail();
+		return lhs_value == rhs_value;
+	}
+	// Both locks at once, the BLK3 way from note 5//
+	friend bool same_detail_locked(Y const& lhs, Y const& rhs) {
+		if (&lhs == &rhs)
+			return true;
+		std::scoped_lock guard(lhs.m, rhs.m);
+		return lhs.some_detail == rhs.some_detail;
+	}
+};
+
+template <typename Mutex>
+double get_detail_block() {
+	Y<Mutex> a(42), b(42);
+	std::atomic<int> equal{ 0 };
+	auto compare = [&]() {
+		int local = 0;
+		for (int i = 0; i < compares_per_thread; ++i) {
+			local += (a == b);
+			local += same_detail_locked(a, b);
+		}
+		equal += local;
+	};
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> thread_vec{};
+	for (size_t i = 0; i < 4; i++) {
+		thread_vec.push_back(std::thread(compare));
+	}
+	// Somebody writes too, through unique_lock//
+	thread_vec.push_back(std::thread([&]() {
+		for (int i = 0; i < compares_per_thread / 10; ++i) {
+			a.set_detail(42);
+		}
+	}));
+	for (std::thread& t : thread_vec) {
+		t.join();
+	}
+	std::chrono::duration<double, std::milli> const ms = std::chrono::steady_clock::now() - start;
+	if (equal != 4 * 2 * compares_per_thread)
+		std::cerr << "wrong compare!!!\n";
+	return ms.count();
+}
+
+int main() {
+	std::cout << "note 4 funcA block, 4 threads:      std::mutex " << funcA_block<std::mutex>()
+		<< " ms, adaptive_mutex " << funcA_block<adaptive_mutex>() << " ms\n";
+	std::cout << "note 5 get_detail block, 4+1 threads: std::mutex " << get_detail_block<std::mutex>()
+		<< " ms, adaptive_mutex " << get_detail_block<adaptive_mutex>() << " ms" << std::endl;
+}
+
+#endif // BLK2
@@ -0,0 +1,439 @@
+#include <thread>
+#include <iostream>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <stop_token>
+#include <stdexcept>
+#include <type_traits>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+/*
+	Two ways we have been launching threads so far:
+		3.Moving_around_threads.cpp P3	=> scoped_thread, one std::thread that joins itself in the destructor
+		4.Data_Race_Mutex.cpp BLK2		=> push raw threads into a std::vector<std::thread>, and join them by hand
+
+	The second one is how lifetime bugs happen:
+		forget one join, or throw before the join loop, and std::terminate is called ( see note 1 ).
+	And everybody picks their own thread count, so 4 libraries x 16 threads on an 8 core box => oversubscription.
+
+	thread_group ( a "nursery" in other languages ) puts the two together:
+		1. spawn() / spawn_n() start workers, each one owned by a scoped_thread
+		2. when the group goes out of scope, ALL of them are joined. No way to forget one.
+		3. cooperative cancellation with std::stop_token ( C++20 ):
+			the group owns a std::stop_source, a worker that takes a std::stop_token as first parameter gets one,
+			and checks stop_requested() whenever it is a good time to stop.
+		4. optionally pin worker i to the i-th CPU we are allowed on, so the scheduler doesn't bounce our workers around.
+		   ( allowed: under taskset / a cpuset that can be 4-7, not 0-3. hardware_concurrency() doesn't know about it )
+*/
+
+// thread_group on top of scoped_thread //
+#define BLK1
+
+// The funcA launch from note 4 BLK2 with a thread_group, plus cancellation ( needs BLK1 ) //
+//#define BLK2
+
+// Collecting exceptions from every worker, and aborting the siblings on the first one ( needs BLK1 ) //
+#define BLK3
+
+
+#ifdef BLK1
+// The scoped_thread from 3.Moving_around_threads.cpp P3, as it is//
+class scoped_thread {
+	std::thread t;
+public:
+	explicit scoped_thread(std::thread src) : t(std::move(src)) {
+		if (!t.joinable()){
+			throw std::logic_error("no thread");
+		}
+	}
+	~scoped_thread() { t.join(); };
+	scoped_thread(scoped_thread const&) = delete;
+	scoped_thread& operator = (scoped_thread const&) = delete;
+};
+
+// The CPU ids the calling thread may run on ( the process's, unless somebody pinned this thread ), in order//
+inline std::vector<unsigned> allowed_cpus() {
+	std::vector<unsigned> cpus;
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (unsigned c = 0; c < CPU_SETSIZE; ++c) {
+			if (CPU_ISSET(c, &set))
+				cpus.push_back(c);
+		}
+	}
+#elif defined(_WIN32)
+	DWORD_PTR process = 0, system = 0;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &process, &system)) {
+		for (unsigned c = 0; c < sizeof(DWORD_PTR) * 8; ++c) {
+			if (process & (DWORD_PTR(1) << c))
+				cpus.push_back(c);
+		}
+	}
+#endif
+	// Can't tell: assume 0 .. n-1//
+	if (cpus.empty()) {
+		unsigned const n = std::thread::hardware_concurrency() == 0 ? 1 : std::thread::hardware_concurrency();
+		for (unsigned c = 0; c < n; ++c) {
+			cpus.push_back(c);
+		}
+	}
+	return cpus;
+}
+
+// Best effort: if the OS says no ( containers, cgroups... ) the thread just runs unpinned. core is a real CPU id//
+inline bool pin_to_core(std::thread& t, unsigned core) {
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return pthread_setaffinity_np(t.native_handle(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+	return SetThreadAffinityMask(static_cast<HANDLE>(t.native_handle()), DWORD_PTR(1) << core) != 0;
+#else
+	(void)t;
+	(void)core;
+	return false;
+#endif
+}
+
+class thread_group {
+	std::stop_source stop;
+	// scoped_thread can't be moved ( copy is deleted, so no move either ). std::deque::emplace_back never moves//
+	// the elements that are already there, std::vector would//
+	std::deque<scoped_thread> threads;
+	bool const pin;
+	std::vector<unsigned> const cpus;
+	unsigned const cores;
+	unsigned next_core = 0;
+
+public:
+	explicit thread_group(bool pin_to_cores = false)
+		: pin(pin_to_cores), cpus(allowed_cpus()), cores(static_cast<unsigned>(cpus.size())) {}
+
+	// Same as std::jthread: ask everybody to stop, then join everybody ( the deque of scoped_threads does the joins )//
+	// If you want the workers to finish on their own instead, call join_all() first//
+	~thread_group() {
+		stop.request_stop();
+	}
+	thread_group(thread_group const&) = delete;
+	thread_group& operator=(thread_group const&) = delete;
+
+	/*
+		Like the std::thread constructor: arguments are copied, use std::ref() for references.
+		If f can be called with a std::stop_token in front of the arguments, it gets the group's token.
+	*/
+	template <typename F, typename... Args>
+	void spawn(F&& f, Args&&... args) {
+		std::thread t;
+		if constexpr (std::is_invocable_v<std::decay_t<F>, std::stop_token, std::decay_t<Args>...>) {
+			t = std::thread(std::forward<F>(f), stop.get_token(), std::forward<Args>(args)...);
+		}
+		else {
+			t = std::thread(std::forward<F>(f), std::forward<Args>(args)...);
+		}
+		if (pin) {
+			pin_to_core(t, cpus[next_core]);
+			next_core = (next_core + 1) % cores;
+		}
+		threads.emplace_back(std::move(t));
+	}
+
+	// n workers running f(index) or f(stop_token, index). n defaults to one per allowed core, not more//
+	template <typename F>
+	void spawn_n(F const& f, std::size_t n = 0) {
+		if (n == 0)
+			n = cores;
+		for (std::size_t i = 0; i < n; ++i) {
+			spawn(f, i);
+		}
+	}
+
+	void request_stop() { stop.request_stop(); }
+	std::stop_token get_stop_token() const { return stop.get_token(); }
+	// A copy shares the same stop state, so whoever holds it can cancel the whole group//
+	std::stop_source get_stop_source() const { return stop; }
+	std::size_t size() const { return threads.size(); }
+
+	// Wait for everybody now, without asking them to stop. The group can be reused afterwards//
+	void join_all() {
+		threads.clear();
+		next_core = 0;
+	}
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	4.Data_Race_Mutex.cpp BLK2 was:
+		std::vector<std::thread> thread_vec{};
+		for (size_t i = 0; i < 4; i++){
+			thread_vec.push_back(std::thread(funcA));
+		}
+		for (thread& x : thread_vec) {
+			x.join();
+		}
+	Now the joins are gone, the group does them.
+*/
+int x = 0;
+std::mutex mu;
+
+void funcA() {
+	std::lock_guard guard1(mu);
+	for (int i = 0; i < 10000; ++i) {
+		x++;
+	}
+}
+
+int main() {
+	{
+		thread_group group(true);
+		for (size_t i = 0; i < 4; i++) {
+			group.spawn(funcA);
+		}
+		// Wait for them to finish naturally, don't cancel//
+		group.join_all();
+	}
+	std::cout << "What is the value of x now: " << x << std::endl;
+
+	// Cancellation: every worker spins until the group asks it to stop//
+	std::atomic<long long> loops{ 0 };
+	{
+		thread_group group(true);
+		group.spawn_n([&loops](std::stop_token st, std::size_t index) {
+			long long mine = 0;
+			while (!st.stop_requested()) {
+				++mine;
+			}
+			loops += mine;
+			std::cout << "worker " << index << " stopped\n";
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		// No request_stop(), no join: leaving the scope does both//
+	}
+	std::cout << "All workers are joined, they looped " << loops << " times in total" << std::endl;
+}
+
+#endif // BLK2
+
+
+
+#ifdef BLK3
+/*
+	4.Data_Race_Mutex.cpp BLK3 moved exceptions out of the threads with:
+		static std::exception_ptr teptr = nullptr;
+		...
+		catch (...){ teptr = std::current_exception(); }
+
+	Two problems with that:
+		1. two threads failing at the same time write teptr at the same time => a data race on the exception_ptr itself,
+		   and one of the errors is silently gone.
+		2. the other threads have no idea somebody failed, so they keep running the rest of a batch that is already
+		   doomed ( the 30100 in that note: three threads finished their loops after the first one threw ).
+
+	exception_collector:
+		1. one slot per worker, each on its own cache line. Worker i only ever writes slot i => no lock, no race.
+		2. two modes:
+			first_error_wins	=> only the first failure is kept ( one CAS decides who was first )
+			collect_all			=> every failure is kept, you get all of them after the join
+		3. the first failure calls request_stop() on a stop_source, so the siblings see stop_requested() and bail out.
+		   Pass it the thread_group's stop source, and the whole group is cancelled.
+		4. more workers than slots ( spawn_n defaults to the core count )? Index >= slots goes to one shared
+		   overflow slot, with a lock. Slower, but never a write past the end.
+*/
+class exception_collector {
+public:
+	enum class mode { first_error_wins, collect_all };
+
+private:
+	struct alignas(64) slot {
+		std::exception_ptr error;
+		std::atomic<bool> ready{ false };
+	};
+
+	std::unique_ptr<slot[]> slots;
+	std::size_t const slot_count;
+	// Every index >= slot_count shares this one. The index stays with the error, so first() can find the winner//
+	mutable std::mutex overflow_mut;
+	std::vector<std::pair<std::size_t, std::exception_ptr>> overflow;
+	mode const kind;
+	std::stop_source abort;
+	std::atomic<long long> first_slot{ -1 };
+
+public:
+	exception_collector(std::size_t workers, mode m, std::stop_source abort_source = std::stop_source())
+		: slots(new slot[workers]), slot_count(workers), kind(m), abort(std::move(abort_source)) {}
+	exception_collector(exception_collector const&) = delete;
+	exception_collector& operator=(exception_collector const&) = delete;
+
+	// Call it from a catch block, in the worker that owns slot index//
+	void capture(std::size_t index) noexcept {
+		long long expected = -1;
+		bool const first = first_slot.compare_exchange_strong(expected, static_cast<long long>(index),
+			std::memory_order_acq_rel);
+		if (first || kind == mode::collect_all) {
+			if (index < slot_count) {
+				slots[index].error = std::current_exception();
+				slots[index].ready.store(true, std::memory_order_release);
+			}
+			else {
+				std::lock_guard<std::mutex> lk(overflow_mut);
+				try {
+					overflow.push_back({ index, std::current_exception() });
+				}
+				catch (...) {
+					// Out of memory while reporting an error: this one is lost, failed() still says true//
+				}
+			}
+		}
+		if (first)
+			abort.request_stop();
+	}
+
+	/*
+		Wraps f so the exception never leaves the thread ( which would be std::terminate ).
+		The result can be given straight to thread_group::spawn_n().
+	*/
+	template <typename F>
+	auto guard(F f) {
+		return [this, f](std::stop_token st, std::size_t index) {
+			try {
+				if constexpr (std::is_invocable_v<F, std::stop_token, std::size_t>)
+					f(st, index);
+				else
+					f(index);
+			}
+			catch (...) {
+				capture(index);
+			}
+		};
+	}
+
+	bool failed() const { return first_slot.load(std::memory_order_acquire) >= 0; }
+
+	// The first failure. May be nullptr while that worker is still inside capture()//
+	std::exception_ptr first() const {
+		long long const i = first_slot.load(std::memory_order_acquire);
+		if (i < 0)
+			return nullptr;
+		if (static_cast<std::size_t>(i) >= slot_count) {
+			// Not overflow.front(): another overflow worker may have taken the lock before the one that won the CAS//
+			std::lock_guard<std::mutex> lk(overflow_mut);
+			for (auto const& [index, error] : overflow) {
+				if (index == static_cast<std::size_t>(i))
+					return error;
+			}
+			return nullptr;
+		}
+		if (!slots[i].ready.load(std::memory_order_acquire))
+			return nullptr;
+		return slots[i].error;
+	}
+
+	// Every kept failure, in worker order. Call it after the workers are joined//
+	std::vector<std::exception_ptr> all() const {
+		std::vector<std::exception_ptr> errors;
+		for (std::size_t i = 0; i < slot_count; ++i) {
+			if (slots[i].ready.load(std::memory_order_acquire))
+				errors.push_back(slots[i].error);
+		}
+		std::lock_guard<std::mutex> lk(overflow_mut);
+		for (auto const& entry : overflow) {
+			errors.push_back(entry.second);
+		}
+		return errors;
+	}
+
+	void rethrow_if_failed() const {
+		if (std::exception_ptr e = first())
+			std::rethrow_exception(e);
+	}
+};
+
+/*
+	The batch from 4.Data_Race_Mutex.cpp BLK3, reworked:
+		every worker runs 10000 steps of its own batch, worker 1 throws at step 100.
+		Every step, the workers check the stop token, so when worker 1 fails the others give up their batch too.
+*/
+int main() {
+	constexpr std::size_t workers = 4;
+	std::atomic<int> steps_done{ 0 };
+
+	auto batch = [&steps_done](std::stop_token st, std::size_t index) {
+		for (int i = 0; i < 10000; ++i) {
+			if (st.stop_requested())
+				return;
+			if (index == 1 && i == 100)
+				throw std::runtime_error("Surprise!!!!!! from worker " + std::to_string(index));
+			steps_done++;
+			std::this_thread::sleep_for(std::chrono::microseconds(10));
+		}
+	};
+
+	{
+		thread_group group;
+		exception_collector errors(workers, exception_collector::mode::first_error_wins, group.get_stop_source());
+		group.spawn_n(errors.guard(batch), workers);
+		group.join_all();
+		try {
+			errors.rethrow_if_failed();
+		}
+		catch (const std::exception& ex) {
+			std::cerr << "Thread exited with exception: " << ex.what() << "\n";
+		}
+		std::cout << "steps done before everybody stopped: " << steps_done << " ( out of " << workers * 10000 << " )\n";
+	}
+
+	// collect_all: every worker fails, we want every message, and no one is cancelled//
+	{
+		thread_group group;
+		exception_collector errors(workers, exception_collector::mode::collect_all);
+		group.spawn_n(errors.guard([](std::size_t index) {
+			throw std::runtime_error("worker " + std::to_string(index) + " failed");
+		}), workers);
+		group.join_all();
+		for (std::exception_ptr const& e : errors.all()) {
+			try {
+				std::rethrow_exception(e);
+			}
+			catch (const std::exception& ex) {
+				std::cerr << "collected: " << ex.what() << "\n";
+			}
+		}
+	}
+
+	// More workers than slots: workers 2 and up share the overflow slot//
+	{
+		thread_group group;
+		exception_collector errors(2, exception_collector::mode::collect_all);
+		group.spawn_n(errors.guard([](std::size_t index) {
+			throw std::runtime_error("worker " + std::to_string(index) + " failed");
+		}), 6);
+		group.join_all();
+		std::cout << "6 workers, 2 slots, errors kept: " << errors.all().size() << "\n";
+		// first() is the worker that won the race, also when it sits in the overflow slot//
+		try {
+			errors.rethrow_if_failed();
+		}
+		catch (const std::exception& ex) {
+			std::cout << "first: " << ex.what() << "\n";
+		}
+	}
+}
+
+#endif // BLK3
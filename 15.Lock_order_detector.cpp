@@ -0,0 +1,399 @@
+#include <thread>
+#include <iostream>
+#include <sstream>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <algorithm>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+#include <cstdint>
+/*
+	5.Dead_Lock_Mutex.cpp BLK1: f1 takes m1 then m2, f2 takes m2 then m1.
+	Run them at the same time and they deadlock. Run them one after the other and everything is fine.
+	So the bug can sit in the code for months and only show up on the one day the timing is right.
+
+	BLK4 of that note says "Use a lock hierarchy". Nothing checks that we actually do.
+
+	The idea ( the Linux kernel calls it lockdep ):
+		Every time a thread takes lock B while it is holding lock A, write down the edge A -> B.
+		If the edges ever form a cycle, A -> B -> ... -> A, there is an order in which those threads can deadlock,
+		even if this run was lucky. So we report it right away, with the threads that created the edges.
+
+	checked_mutex<Mutex> wraps any mutex and does that. It is still Lockable ( lock / try_lock / unlock ),
+	so lock_guard, scoped_lock and unique_lock keep working. Mixing types is fine: checked_mutex<std::mutex> and
+	checked_mutex<std::timed_mutex> share the ids and the per thread bookkeeping ( checked_mutex_base ).
+
+	Overhead:
+		the order graph is global and protected by a mutex, but a thread only goes there for an edge it hasn't
+		seen before. Every thread caches the edges it already reported, so in steady state a lock() costs a
+		hash lookup per lock already held ( usually zero or one ) plus the real lock.
+		A checked_mutex takes its node and edges out of the graph when it dies. The thread caches can't be
+		reached from another thread, so every thread drops the dead edges itself, whenever its cache doubles.
+		=> memory follows the mutexes that are alive, fine to leave on in a process that keeps making new ones.
+
+	Hierarchy mode:
+		give a checked_mutex a level ( > 0 ), and a thread may only lock it while every levelled lock it holds has
+		a HIGHER level. Otherwise lock() throws std::logic_error before even trying.
+		This is the hierarchical_mutex from Anthony Williams' book, on the same wrapper.
+*/
+
+// checked_mutex and the lock order graph //
+#define BLK1
+
+// The f1 / f2 example from note 5 BLK1, hierarchy mode, and the overhead ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+class lock_order_graph {
+	struct edge {
+		std::uint32_t to;
+		std::thread::id by;
+	};
+
+	std::mutex mut;
+	std::unordered_map<std::uint32_t, std::vector<edge>> edges;
+	// to -> every from with an edge to it, so a dying mutex finds its incoming edges without a full scan//
+	std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> incoming;
+	std::unordered_set<std::uint32_t> alive;
+	std::unordered_map<std::uint32_t, std::string> names;
+	std::function<void(std::string const&)> handler;
+	std::atomic<std::uint64_t> cycle_count{ 0 };
+	std::atomic<std::uint64_t> removals{ 0 };
+
+	// Depth first search from "from", looking for "target". Fills path with the edges on the way//
+	bool find_path(std::uint32_t from, std::uint32_t target, std::vector<std::pair<std::uint32_t, edge>>& path,
+		std::unordered_set<std::uint32_t>& seen) {
+		if (!seen.insert(from).second)
+			return false;
+		auto it = edges.find(from);
+		if (it == edges.end())
+			return false;
+		for (edge const& e : it->second) {
+			path.push_back({ from, e });
+			if (e.to == target || find_path(e.to, target, path, seen))
+				return true;
+			path.pop_back();
+		}
+		return false;
+	}
+
+	std::string name_of(std::uint32_t id) const {
+		auto it = names.find(id);
+		return it == names.end() ? "#" + std::to_string(id) : it->second;
+	}
+
+public:
+	lock_order_graph() {
+		handler = [](std::string const& report) {std::cerr << report; };
+	}
+
+	static lock_order_graph& instance() {
+		static lock_order_graph graph;
+		return graph;
+	}
+
+	void add_mutex(std::uint32_t id, std::string name) {
+		std::lock_guard<std::mutex> lk(mut);
+		alive.insert(id);
+		if (!name.empty())
+			names[id] = std::move(name);
+	}
+
+	// The mutex is gone: its name, its edges out and its edges in go with it//
+	void remove_mutex(std::uint32_t id) {
+		std::lock_guard<std::mutex> lk(mut);
+		alive.erase(id);
+		names.erase(id);
+		if (auto in = incoming.find(id); in != incoming.end()) {
+			for (std::uint32_t from : in->second) {
+				auto out = edges.find(from);
+				if (out == edges.end())
+					continue;
+				std::erase_if(out->second, [id](edge const& e) {return e.to == id; });
+				if (out->second.empty())
+					edges.erase(out);
+			}
+			incoming.erase(in);
+		}
+		if (auto out = edges.find(id); out != edges.end()) {
+			for (edge const& e : out->second) {
+				auto in = incoming.find(e.to);
+				if (in == incoming.end())
+					continue;
+				std::erase(in->second, id);
+				if (in->second.empty())
+					incoming.erase(in);
+			}
+			edges.erase(out);
+		}
+		removals.fetch_add(1, std::memory_order_release);
+	}
+
+	std::uint64_t removed_so_far() const { return removals.load(std::memory_order_acquire); }
+
+	// Drop the cached edges ( held << 32 | wanted ) that touch a mutex that is gone//
+	void prune(std::unordered_set<std::uint64_t>& cache) {
+		std::lock_guard<std::mutex> lk(mut);
+		std::erase_if(cache, [this](std::uint64_t key) {
+			return !alive.contains(static_cast<std::uint32_t>(key >> 32)) || !alive.contains(static_cast<std::uint32_t>(key));
+		});
+	}
+
+	// For the demo: how big is the graph right now//
+	std::size_t edge_count() {
+		std::lock_guard<std::mutex> lk(mut);
+		std::size_t n = 0;
+		for (auto const& out : edges) {
+			n += out.second.size();
+		}
+		return n;
+	}
+
+	// Replace the default "print to stderr", e.g. to log it or to fail a test//
+	void on_cycle(std::function<void(std::string const&)> h) {
+		std::lock_guard<std::mutex> lk(mut);
+		handler = std::move(h);
+	}
+
+	std::uint64_t cycles_found() const { return cycle_count.load(std::memory_order_relaxed); }
+
+	// held -> wanted was just seen for the first time by this thread//
+	void add_edge(std::uint32_t held, std::uint32_t wanted) {
+		std::lock_guard<std::mutex> lk(mut);
+		std::vector<edge>& out = edges[held];
+		if (std::any_of(out.begin(), out.end(), [wanted](edge const& e) {return e.to == wanted; }))
+			return;
+		out.push_back({ wanted, std::this_thread::get_id() });
+		incoming[wanted].push_back(held);
+
+		// A new edge held -> wanted closes a cycle if wanted can already reach held//
+		std::vector<std::pair<std::uint32_t, edge>> path;
+		std::unordered_set<std::uint32_t> seen;
+		if (!find_path(wanted, held, path, seen))
+			return;
+		cycle_count.fetch_add(1, std::memory_order_relaxed);
+		std::ostringstream report;
+		report << "POTENTIAL DEADLOCK, lock order cycle:\n";
+		report << "    " << name_of(held) << " -> " << name_of(wanted) << "   ( thread " << std::this_thread::get_id() << " )\n";
+		for (auto const& step : path) {
+			report << "    " << name_of(step.first) << " -> " << name_of(step.second.to)
+				<< "   ( thread " << step.second.by << " )\n";
+		}
+		handler(report.str());
+	}
+};
+
+/*
+	Everything that is NOT about the Mutex type. It can't be a static of the template: checked_mutex<std::mutex> and
+	checked_mutex<std::timed_mutex> would each count ids from 0 and keep their own held stack, and one thread holding
+	one of each would never see the edge between them.
+*/
+class checked_mutex_base {
+protected:
+	struct held_lock {
+		checked_mutex_base const* m;
+		std::uint32_t id;
+		unsigned long level;
+	};
+
+	// What the current thread holds right now, in locking order, whatever the Mutex type//
+	static std::vector<held_lock>& held() {
+		thread_local std::vector<held_lock> stack;
+		return stack;
+	}
+	// The edges this thread already sent to the graph//
+	struct edge_cache {
+		std::unordered_set<std::uint64_t> keys;
+		std::uint64_t removals_seen = 0;
+		std::size_t prune_at = 64;
+	};
+	static edge_cache& known_edges() {
+		thread_local edge_cache cache;
+		return cache;
+	}
+	// When the cache has doubled since last time, and some mutex died since then, drop the dead edges//
+	static void maybe_prune(edge_cache& cache) {
+		if (cache.keys.size() < cache.prune_at)
+			return;
+		lock_order_graph& graph = lock_order_graph::instance();
+		std::uint64_t const removed = graph.removed_so_far();
+		if (removed != cache.removals_seen) {
+			graph.prune(cache.keys);
+			cache.removals_seen = removed;
+		}
+		cache.prune_at = std::max<std::size_t>(64, cache.keys.size() * 2);
+	}
+	static std::uint32_t next_id() {
+		static std::atomic<std::uint32_t> counter{ 0 };
+		return counter.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::uint32_t const id;
+	unsigned long const level;
+
+	checked_mutex_base(std::string name, unsigned long hierarchy_level) : id(next_id()), level(hierarchy_level) {
+		lock_order_graph::instance().add_mutex(id, std::move(name));
+	}
+	~checked_mutex_base() {
+		lock_order_graph::instance().remove_mutex(id);
+	}
+
+	void check_before_lock() {
+		std::vector<held_lock> const& stack = held();
+		edge_cache& cache = known_edges();
+		if (!stack.empty())
+			maybe_prune(cache);
+		for (held_lock const& h : stack) {
+			if (level != 0 && h.level != 0 && h.level <= level) {
+				throw std::logic_error("mutex hierarchy violated: locking level " + std::to_string(level) +
+					" while holding level " + std::to_string(h.level));
+			}
+			std::uint64_t const key = (static_cast<std::uint64_t>(h.id) << 32) | id;
+			if (cache.keys.insert(key).second)
+				lock_order_graph::instance().add_edge(h.id, id);
+		}
+	}
+	void now_held() {
+		held().push_back({ this, id, level });
+	}
+	void no_longer_held() {
+		std::vector<held_lock>& stack = held();
+		// Usually the last one, but unique_lock lets you unlock in any order//
+		for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+			if (it->m == this) {
+				stack.erase(std::next(it).base());
+				break;
+			}
+		}
+	}
+
+public:
+	checked_mutex_base(checked_mutex_base const&) = delete;
+	checked_mutex_base& operator=(checked_mutex_base const&) = delete;
+};
+
+template <typename Mutex = std::mutex>
+class checked_mutex : public checked_mutex_base {
+	Mutex m;
+
+public:
+	explicit checked_mutex(std::string name = {}, unsigned long hierarchy_level = 0)
+		: checked_mutex_base(std::move(name), hierarchy_level) {}
+
+	void lock() {
+		check_before_lock();
+		m.lock();
+		now_held();
+	}
+
+	// A try_lock can't block, so it can't deadlock. No edge for it ( that's also why std::lock() doesn't trigger it )//
+	bool try_lock() {
+		if (!m.try_lock())
+			return false;
+		now_held();
+		return true;
+	}
+
+	void unlock() {
+		no_longer_held();
+		m.unlock();
+	}
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+int main() {
+	// 1. Note 5 BLK1, but f1 and f2 never run at the same time, so there is no real deadlock//
+	{
+		checked_mutex<> m1("m1");
+		checked_mutex<> m2("m2");
+		auto f1 = [&m1, &m2]() {
+			std::lock_guard lg1(m1);
+			std::lock_guard lg2(m2);
+		};
+		auto f2 = [&m1, &m2]() {
+			std::lock_guard lg1(m2);
+			std::lock_guard lg2(m1);
+		};
+		std::thread thread1(f1);
+		thread1.join();
+		std::thread thread2(f2);
+		thread2.join();
+		std::cout << "cycles found: " << lock_order_graph::instance().cycles_found() << "\n";
+
+		// scoped_lock goes through std::lock(), which uses try_lock for the second mutex: no false alarm//
+		std::thread thread3([&]() {std::scoped_lock guard(m2, m1); });
+		thread3.join();
+		std::cout << "cycles found after scoped_lock: " << lock_order_graph::instance().cycles_found() << "\n";
+	}
+
+	// 2. Hierarchy mode: high level first, then lower. The other way round throws//
+	{
+		checked_mutex<> high_level_mutex("high", 10000);
+		checked_mutex<> low_level_mutex("low", 5000);
+		{
+			std::lock_guard lk1(high_level_mutex);
+			std::lock_guard lk2(low_level_mutex);
+			std::cout << "high -> low is fine\n";
+		}
+		try {
+			std::lock_guard lk1(low_level_mutex);
+			std::lock_guard lk2(high_level_mutex);
+		}
+		catch (std::logic_error const& e) {
+			std::cout << "low -> high: " << e.what() << "\n";
+		}
+	}
+
+	// 3. What does it cost? One lock already held, lock + unlock another one a million times//
+	{
+		constexpr int rounds = 1000000;
+		auto time_it = [](auto& outer, auto& inner) {
+			std::lock_guard hold(outer);
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < rounds; ++i) {
+				std::lock_guard lk(inner);
+			}
+			return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+		};
+		std::mutex a, b;
+		checked_mutex<> ca("a"), cb("b");
+		std::cout << "std::mutex lock+unlock: " << time_it(a, b) << " ns, checked_mutex: " << time_it(ca, cb) << " ns" << std::endl;
+	}
+	// 4. A long running process making new mutexes all the time: the graph only holds the living ones//
+	{
+		checked_mutex<> outer("outer");
+		for (int i = 0; i < 100000; ++i) {
+			checked_mutex<> temp;
+			std::lock_guard lk1(outer);
+			std::lock_guard lk2(temp);
+		}
+		std::cout << "edges in the graph after 100000 short lived mutexes: " << lock_order_graph::instance().edge_count() << std::endl;
+	}
+	// 5. Two mutex types, one graph: ids and held locks are shared, so a -> d and d -> a is still a cycle//
+	{
+		checked_mutex<std::mutex> a("a");
+		checked_mutex<std::timed_mutex> d("d");
+		std::uint64_t const before = lock_order_graph::instance().cycles_found();
+		std::thread([&]() {
+			std::lock_guard lk1(a);
+			std::lock_guard lk2(d);
+		}).join();
+		std::thread([&]() {
+			std::lock_guard lk1(d);
+			std::lock_guard lk2(a);
+		}).join();
+		std::cout << "std::mutex + std::timed_mutex, cycles found: " << lock_order_graph::instance().cycles_found() - before << std::endl;
+	}
+}
+
+#endif // BLK2
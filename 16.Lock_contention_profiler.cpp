@@ -0,0 +1,409 @@
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <mutex>
+#include <queue>
+#include <deque>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#if defined(__linux__) || defined(__APPLE__)
+#include <dlfcn.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+/*
+	We have a lot of mutexes by now:
+		mu in 4.Data_Race_Mutex.cpp, m1 / m2 and X::m in 5.Dead_Lock_Mutex.cpp, mut in 6.Sharing_data_between_threads.cpp
+	Which one hurts? Nobody knows, because none of them says how long threads WAIT for it, or how long it is HELD.
+
+	profiled_mutex<Mutex> wraps a mutex and measures both, every time:
+		wait => from "I want the lock" to "I have the lock"
+		hold => from "I have the lock" to unlock()
+	A lock with a long wait and a short hold => contention, shard it or make it finer ( note 5 BLK7 )
+	A lock with a long hold => somebody does too much work inside the critical section
+
+	Where it goes:
+		every ( lock name, call site ) pair gets two histograms.
+		The call site is the return address of lock(), which with optimisations on is the line in your code where
+		the lock_guard / scoped_lock / unique_lock was created ( they are all inlined ).
+		scoped_lock with two or more mutexes goes through std::lock(), so its site shows up inside std::lock.
+		report() prints them all, sorted by total wait time. Set report_at_exit(true) to get it when the program ends.
+
+	The histograms are lock-free ( we are not going to profile a lock with another lock ):
+		HDR-style log-linear buckets, every bucket is a relaxed atomic counter.
+		Bucket width grows with the value, so the relative error stays ~12% from 1 ns to minutes.
+*/
+
+// profiled_mutex, histograms and the report //
+#define BLK1
+
+// The mutexes from note 4, 5 and 6, profiled ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+/*
+	Bucket = ( power of two, one of 8 sub-buckets inside it ).
+	Values below 8 ns get a bucket each. 8 sub-buckets => the width is 1/8 of the power of two => ~12% error.
+*/
+class latency_histogram {
+	static constexpr int sub_bits = 3;
+	static constexpr int sub_count = 1 << sub_bits;
+	static constexpr int bucket_count = 64 * sub_count;
+	std::atomic<std::uint64_t> buckets[bucket_count]{};
+	std::atomic<std::uint64_t> total_ns{ 0 };
+	std::atomic<std::uint64_t> max_ns{ 0 };
+
+	static int index_of(std::uint64_t v) {
+		if (v < sub_count)
+			return static_cast<int>(v);
+		int msb = 63;
+		while (!(v >> msb))
+			--msb;
+		int const shift = msb - sub_bits;
+		return (shift + 1) * sub_count + static_cast<int>((v >> shift) & (sub_count - 1));
+	}
+	// The lowest value that lands in bucket i//
+	static std::uint64_t value_of(int i) {
+		if (i < sub_count)
+			return static_cast<std::uint64_t>(i);
+		int const shift = i / sub_count - 1;
+		return (static_cast<std::uint64_t>(sub_count + i % sub_count)) << shift;
+	}
+
+public:
+	void record(std::uint64_t ns) {
+		buckets[index_of(ns)].fetch_add(1, std::memory_order_relaxed);
+		total_ns.fetch_add(ns, std::memory_order_relaxed);
+		std::uint64_t m = max_ns.load(std::memory_order_relaxed);
+		while (ns > m && !max_ns.compare_exchange_weak(m, ns, std::memory_order_relaxed));
+	}
+
+	std::uint64_t count() const {
+		std::uint64_t n = 0;
+		for (auto const& b : buckets)
+			n += b.load(std::memory_order_relaxed);
+		return n;
+	}
+	std::uint64_t total() const { return total_ns.load(std::memory_order_relaxed); }
+	std::uint64_t max() const { return max_ns.load(std::memory_order_relaxed); }
+
+	std::uint64_t percentile(double p) const {
+		std::uint64_t const n = count();
+		if (n == 0)
+			return 0;
+		auto const rank = static_cast<std::uint64_t>(p * static_cast<double>(n - 1));
+		std::uint64_t seen = 0;
+		for (int i = 0; i < bucket_count; ++i) {
+			seen += buckets[i].load(std::memory_order_relaxed);
+			if (seen > rank)
+				return value_of(i);
+		}
+		return max();
+	}
+};
+
+// One ( lock, call site ) pair//
+struct site_stats {
+	std::atomic<std::uintptr_t> site{ 0 };
+	latency_histogram wait;
+	latency_histogram hold;
+};
+
+/*
+	The stats of one lock.
+	A fixed table of call sites, filled with CAS on first use, so recording never blocks.
+	If a lock is used from more than max_sites places, the extra ones all go to the last slot ( "other" ).
+*/
+struct lock_stats {
+	static constexpr int max_sites = 32;
+	std::string name;
+	std::atomic<site_stats*> sites[max_sites]{};
+
+	explicit lock_stats(std::string n) : name(std::move(n)) {}
+	~lock_stats() {
+		for (auto& s : sites)
+			delete s.load();
+	}
+
+	site_stats& for_site(std::uintptr_t site) {
+		std::size_t const start = (site >> 4) % max_sites;
+		for (int probe = 0; probe < max_sites - 1; ++probe) {
+			std::atomic<site_stats*>& slot = sites[(start + probe) % (max_sites - 1)];
+			site_stats* s = slot.load(std::memory_order_acquire);
+			if (!s) {
+				// First time here: try to install a fresh one. If somebody else was faster, use theirs//
+				auto fresh = std::make_unique<site_stats>();
+				fresh->site.store(site, std::memory_order_relaxed);
+				if (slot.compare_exchange_strong(s, fresh.get(), std::memory_order_acq_rel))
+					return *fresh.release();
+			}
+			if (s->site.load(std::memory_order_relaxed) == site)
+				return *s;
+		}
+		std::atomic<site_stats*>& other = sites[max_sites - 1];
+		site_stats* s = other.load(std::memory_order_acquire);
+		if (!s) {
+			auto fresh = std::make_unique<site_stats>();
+			if (other.compare_exchange_strong(s, fresh.get(), std::memory_order_acq_rel))
+				return *fresh.release();
+		}
+		return *s;
+	}
+};
+
+/*
+	Every profiled lock registers here ( once, in its constructor, so this mutex is not on the hot path ).
+	The registry owns the stats, so a lock that is already destroyed still shows up in the report at exit.
+*/
+class lock_profiler {
+	std::mutex mut;
+	std::vector<std::shared_ptr<lock_stats>> locks;
+	std::atomic<bool> at_exit{ false };
+
+	static std::string describe_site(std::uintptr_t site) {
+		std::ostringstream out;
+		out << "0x" << std::hex << site;
+#if defined(__linux__) || defined(__APPLE__)
+		// Needs -rdynamic for functions in the executable itself, otherwise use addr2line on the address//
+		Dl_info info;
+		if (site && dladdr(reinterpret_cast<void*>(site), &info) && info.dli_sname) {
+			out << " " << info.dli_sname << "+0x" << (site - reinterpret_cast<std::uintptr_t>(info.dli_saddr));
+		}
+#endif
+		return out.str();
+	}
+
+public:
+	static lock_profiler& instance() {
+		static lock_profiler profiler;
+		return profiler;
+	}
+	~lock_profiler() {
+		if (at_exit.load())
+			report(std::cerr);
+	}
+
+	// Locks with the same name share their stats, e.g. the X::m of every X//
+	std::shared_ptr<lock_stats> add(std::string name) {
+		std::lock_guard<std::mutex> lk(mut);
+		for (auto const& l : locks) {
+			if (l->name == name)
+				return l;
+		}
+		locks.push_back(std::make_shared<lock_stats>(std::move(name)));
+		return locks.back();
+	}
+
+	void report_at_exit(bool on) { at_exit.store(on); }
+
+	void report(std::ostream& out) {
+		struct row {
+			std::string lock;
+			std::string site;
+			site_stats const* s;
+		};
+		std::vector<row> rows;
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			for (auto const& l : locks) {
+				for (auto const& slot : l->sites) {
+					if (site_stats const* s = slot.load(std::memory_order_acquire))
+						rows.push_back({ l->name, describe_site(s->site.load()), s });
+				}
+			}
+		}
+		std::sort(rows.begin(), rows.end(), [](row const& a, row const& b) {return a.s->wait.total() > b.s->wait.total(); });
+		out << "lock contention report ( ns )\n";
+		out << std::left << std::setw(16) << "lock" << std::right << std::setw(10) << "count"
+			<< std::setw(12) << "wait total" << std::setw(10) << "wait p50" << std::setw(10) << "wait p99" << std::setw(12) << "wait max"
+			<< std::setw(10) << "hold p50" << std::setw(10) << "hold p99" << std::setw(12) << "hold max" << "   call site\n";
+		for (row const& r : rows) {
+			out << std::left << std::setw(16) << r.lock << std::right << std::setw(10) << r.s->hold.count()
+				<< std::setw(12) << r.s->wait.total() << std::setw(10) << r.s->wait.percentile(0.5)
+				<< std::setw(10) << r.s->wait.percentile(0.99) << std::setw(12) << r.s->wait.max()
+				<< std::setw(10) << r.s->hold.percentile(0.5) << std::setw(10) << r.s->hold.percentile(0.99)
+				<< std::setw(12) << r.s->hold.max() << "   " << r.site << "\n";
+		}
+	}
+};
+
+#if defined(_MSC_VER)
+#define LOCK_PROFILER_NOINLINE __declspec(noinline)
+#define LOCK_PROFILER_CALLER() reinterpret_cast<std::uintptr_t>(_ReturnAddress())
+#else
+#define LOCK_PROFILER_NOINLINE __attribute__((noinline))
+#define LOCK_PROFILER_CALLER() reinterpret_cast<std::uintptr_t>(__builtin_return_address(0))
+#endif
+
+template <typename Mutex = std::mutex>
+class profiled_mutex {
+	using clock = std::chrono::steady_clock;
+
+	Mutex m;
+	std::shared_ptr<lock_stats> stats;
+	// Only written by the thread that holds m, so they are protected by m itself//
+	clock::time_point acquired;
+	site_stats* owner_site = nullptr;
+
+	static std::uint64_t ns(clock::duration d) {
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+	}
+
+	void on_acquired(site_stats& site, clock::time_point now, std::uint64_t waited) {
+		site.wait.record(waited);
+		acquired = now;
+		owner_site = &site;
+	}
+
+public:
+	explicit profiled_mutex(std::string name) : stats(lock_profiler::instance().add(std::move(name))) {}
+	profiled_mutex(profiled_mutex const&) = delete;
+	profiled_mutex& operator=(profiled_mutex const&) = delete;
+
+	// noinline, so the return address is the caller's code//
+	LOCK_PROFILER_NOINLINE void lock() {
+		site_stats& site = stats->for_site(LOCK_PROFILER_CALLER());
+		// Uncontended: one clock read. Contended: two//
+		if (m.try_lock()) {
+			on_acquired(site, clock::now(), 0);
+			return;
+		}
+		clock::time_point const start = clock::now();
+		m.lock();
+		clock::time_point const now = clock::now();
+		on_acquired(site, now, ns(now - start));
+	}
+
+	LOCK_PROFILER_NOINLINE bool try_lock() {
+		if (!m.try_lock())
+			return false;
+		on_acquired(stats->for_site(LOCK_PROFILER_CALLER()), clock::now(), 0);
+		return true;
+	}
+
+	void unlock() {
+		site_stats* const site = owner_site;
+		std::uint64_t const held = ns(clock::now() - acquired);
+		m.unlock();
+		site->hold.record(held);
+	}
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	Three of our old friends, with names:
+		mu		=> four funcA threads doing x++, one lock per increment ( note 4 BLK2 style )
+		m1, m2	=> note 5 BLK1, but in the same order this time ( no deadlock ), with some work inside
+		X::m	=> the swap from note 5 BLK3, on an array of X, every X has its own lock
+		mut		=> the producer/consumer from note 6 BLK2
+*/
+class X {
+	int some_detail;
+	profiled_mutex<> m{ "X::m" };
+public:
+	X(int sd) :some_detail(sd) {}
+	friend void swap(X& lhs, X& rhs) {
+		if (&lhs == &rhs)
+			return;
+		std::scoped_lock guard(lhs.m, rhs.m);
+		std::swap(lhs.some_detail, rhs.some_detail);
+	}
+};
+
+int main() {
+	lock_profiler::instance().report_at_exit(true);
+
+	profiled_mutex<> mu("mu");
+	int x = 0;
+	{
+		std::vector<std::thread> thread_vec{};
+		for (size_t i = 0; i < 4; i++) {
+			thread_vec.push_back(std::thread([&]() {
+				for (int n = 0; n < 100000; ++n) {
+					std::lock_guard guard1(mu);
+					x++;
+				}
+			}));
+		}
+		for (std::thread& t : thread_vec) {
+			t.join();
+		}
+	}
+
+	profiled_mutex<> m1("m1");
+	profiled_mutex<> m2("m2");
+	{
+		auto f = [&]() {
+			for (int n = 0; n < 200; ++n) {
+				std::scoped_lock both(m1, m2);
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+		};
+		std::thread thread1(f);
+		std::thread thread2(f);
+		thread1.join();
+		thread2.join();
+	}
+
+	{
+		// X can't move ( the mutex can't ), deque never moves its elements//
+		std::deque<X> xs;
+		for (int i = 0; i < 8; ++i) {
+			xs.emplace_back(i);
+		}
+		auto swapper = [&xs](unsigned seed) {
+			for (int n = 0; n < 20000; ++n) {
+				seed = seed * 1664525u + 1013904223u;
+				swap(xs[seed % 8], xs[(seed >> 8) % 8]);
+			}
+		};
+		std::thread thread1(swapper, 1u);
+		std::thread thread2(swapper, 2u);
+		thread1.join();
+		thread2.join();
+	}
+
+	profiled_mutex<> mut("mut");
+	{
+		std::queue<int> data_queue;
+		std::condition_variable_any data_cond;
+		std::thread producer([&]() {
+			for (int i = 0; i <= 100000; ++i) {
+				{
+					std::lock_guard lk(mut);
+					data_queue.push(i);
+				}
+				data_cond.notify_one();
+			}
+		});
+		std::thread consumer([&]() {
+			while (true) {
+				std::unique_lock lk(mut);
+				data_cond.wait(lk, [&] {return !data_queue.empty(); });
+				int const data = data_queue.front();
+				data_queue.pop();
+				lk.unlock();
+				if (data == 100000)
+					break;
+			}
+		});
+		producer.join();
+		consumer.join();
+	}
+	std::cout << "x = " << x << ", the report is printed at exit" << std::endl;
+}
+
+#endif // BLK2
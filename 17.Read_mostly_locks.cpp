@@ -0,0 +1,432 @@
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+/*
+	5.Dead_Lock_Mutex.cpp BLK7, Y::get_detail():
+		std::lock_guard<std::mutex> lock_a(m);
+		return some_detail;
+	It only READS some_detail, but std::mutex doesn't care, so two threads comparing Ys wait for each other.
+
+	std::shared_mutex lets readers in together. But every lock_shared() still writes the SAME reader counter
+	inside the shared_mutex, so every reader steals that cache line from every other reader.
+	With 16 readers on 16 cores, the reads are "parallel" and still scale like a single lock.
+	( Like a library where every reader has to sign the same guest book, one pen, before opening a book )
+
+	The big-reader lock ( brlock, from the Linux kernel ) gives every core its own reader counter,
+	on its own cache line. A reader only touches its own counter and READS the writer flag.
+	Readers never write the same memory => reads scale linearly.
+	The price is paid by the writer: it raises the flag and then has to look at EVERY counter until all of them are 0.
+	That's a great deal when 99.9% of the operations are reads ( config lookups ), and a terrible one otherwise.
+
+	br_lock has lock / unlock / try_lock and lock_shared / unlock_shared / try_lock_shared,
+	so std::unique_lock, std::lock_guard AND std::shared_lock all work with it.
+
+	Even br_lock makes every reader WRITE something ( its own counter ). For a small struct there is a way where
+	readers write nothing at all: the seqlock ( BLK3 ).
+*/
+
+// br_lock, the big-reader lock //
+#define BLK1
+
+// Y::operator== from note 5 BLK7 with 1 to 64 readers: std::mutex vs std::shared_mutex vs br_lock ( needs BLK1 ) //
+//#define BLK2
+
+// seqlock<T>, lock-free reads of a small trivially copyable struct ( needs BLK1, for cpu_relax ) //
+#define BLK3
+
+// A market data snapshot: std::atomic<quote> vs br_lock vs seqlock<quote> ( needs BLK1 and BLK3 ) //
+// ( std::atomic<quote> is not lock free, g++ wants -latomic for it )//
+#define BLK4
+
+
+#ifdef BLK1
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+/*
+	"Per core" really is "per thread, spread over as many slots as there are cores":
+	unlock_shared() has to decrement the SAME counter lock_shared() incremented, and a thread can move to another
+	core in between. So every thread gets a fixed slot number the first time it reads, round robin.
+*/
+class br_lock {
+	struct alignas(64) reader_slot {
+		std::atomic<std::uint32_t> readers{ 0 };
+	};
+
+	std::unique_ptr<reader_slot[]> slots;
+	std::size_t const mask;
+	alignas(64) std::atomic<bool> writer{ false };
+	std::mutex writers;
+
+	static std::size_t slot_count() {
+		std::size_t n = 1;
+		while (n < std::thread::hardware_concurrency())
+			n *= 2;
+		return n;
+	}
+	static std::size_t thread_slot() {
+		static std::atomic<std::size_t> next{ 0 };
+		thread_local std::size_t const mine = next.fetch_add(1, std::memory_order_relaxed);
+		return mine;
+	}
+	std::atomic<std::uint32_t>& my_counter() { return slots[thread_slot() & mask].readers; }
+
+public:
+	br_lock() : slots(new reader_slot[slot_count()]), mask(slot_count() - 1) {}
+	br_lock(br_lock const&) = delete;
+	br_lock& operator=(br_lock const&) = delete;
+
+	/*
+		Reader and writer both "write mine, then read theirs" ( seq_cst on both sides ):
+			reader: counter++, then look at the flag
+			writer: flag = true, then look at the counters
+		So at least one of them sees the other. Either the reader backs off, or the writer waits for it.
+	*/
+	bool try_lock_shared() {
+		std::atomic<std::uint32_t>& counter = my_counter();
+		counter.fetch_add(1, std::memory_order_seq_cst);
+		if (!writer.load(std::memory_order_seq_cst))
+			return true;
+		counter.fetch_sub(1, std::memory_order_release);
+		return false;
+	}
+
+	void lock_shared() {
+		while (!try_lock_shared()) {
+			// A writer is in, sleep until it drops the flag//
+			writer.wait(true, std::memory_order_acquire);
+		}
+	}
+
+	void unlock_shared() {
+		my_counter().fetch_sub(1, std::memory_order_release);
+	}
+
+	// Writers queue on a normal mutex, the one that gets it raises the flag and waits for the readers to drain//
+	void lock() {
+		writers.lock();
+		writer.store(true, std::memory_order_seq_cst);
+		for (std::size_t i = 0; i <= mask; ++i) {
+			// Readers hold the lock for a short time and there are no sleepers to wake up, so just spin, politely//
+			for (int spins = 0; slots[i].readers.load(std::memory_order_seq_cst) != 0; ++spins) {
+				if (spins < 64)
+					cpu_relax();
+				else
+					std::this_thread::yield();
+			}
+		}
+	}
+
+	bool try_lock() {
+		if (!writers.try_lock())
+			return false;
+		writer.store(true, std::memory_order_seq_cst);
+		for (std::size_t i = 0; i <= mask; ++i) {
+			if (slots[i].readers.load(std::memory_order_seq_cst) != 0) {
+				writer.store(false, std::memory_order_release);
+				writer.notify_all();
+				writers.unlock();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void unlock() {
+		writer.store(false, std::memory_order_release);
+		writer.notify_all();
+		writers.unlock();
+	}
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	Y from 5.Dead_Lock_Mutex.cpp BLK7, templated on the mutex.
+	get_detail() takes a shared_lock when the mutex has lock_shared(), a lock_guard otherwise ( std::mutex ).
+	Every reader thread does 999 operator== and 1 set_detail() out of every 1000 operations.
+*/
+template <typename Mutex>
+class Y {
+private:
+	int some_detail;
+	mutable Mutex m;
+	int get_detail() const
+	{
+		if constexpr (requires(Mutex & mu) { mu.lock_shared(); }) {
+			std::shared_lock<Mutex> lock_a(m);
+			return some_detail;
+		}
+		else {
+			std::lock_guard<Mutex> lock_a(m);
+			return some_detail;
+		}
+	}
+public:
+	Y(int sd) :some_detail(sd) {}
+	void set_detail(int sd) {
+		std::lock_guard<Mutex> lock_a(m);
+		some_detail = sd;
+	}
+	friend bool operator==(Y const& lhs, Y const& rhs)
+	{
+		if (&lhs == &rhs)
+			return true;
+		int const lhs_value = lhs.get_detail();
+		int const rhs_value = rhs.get_detail();
+		return lhs_value == rhs_value;
+	}
+};
+
+constexpr int ops_per_thread = 100000;
+
+// Million operations per second//
+template <typename Mutex>
+double compare_throughput(int threads) {
+	Y<Mutex> a(42), b(42);
+	std::atomic<int> equal{ 0 };
+	auto reader = [&]() {
+		int local = 0;
+		for (int i = 0; i < ops_per_thread; ++i) {
+			if (i % 1000 == 999)
+				a.set_detail(42);
+			else
+				local += (a == b);
+		}
+		equal += local;
+	};
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> thread_vec{};
+	for (int i = 0; i < threads; i++) {
+		thread_vec.push_back(std::thread(reader));
+	}
+	for (std::thread& t : thread_vec) {
+		t.join();
+	}
+	std::chrono::duration<double, std::micro> const us = std::chrono::steady_clock::now() - start;
+	if (equal != threads * (ops_per_thread - ops_per_thread / 1000))
+		std::cerr << "wrong compare!!!\n";
+	return threads * ops_per_thread / us.count();
+}
+
+int main() {
+	std::cout << "Y::operator==, 99.9% reads, million ops per second ( " << std::thread::hardware_concurrency() << " cores )\n";
+	std::cout << std::setw(8) << "readers" << std::setw(14) << "std::mutex" << std::setw(18) << "std::shared_mutex"
+		<< std::setw(12) << "br_lock" << "\n";
+	for (int threads : { 1, 2, 4, 8, 16, 32, 64 }) {
+		std::cout << std::setw(8) << threads << std::fixed << std::setprecision(2)
+			<< std::setw(14) << compare_throughput<std::mutex>(threads)
+			<< std::setw(18) << compare_throughput<std::shared_mutex>(threads)
+			<< std::setw(12) << compare_throughput<br_lock>(threads) << std::endl;
+	}
+}
+
+#endif // BLK2
+
+
+
+#ifdef BLK3
+/*
+	7.Atomic_and_multi_threading.cpp: a user defined type can be std::atomic<T> if it is trivially copyable,
+	one continuous block of memory, no virtuals. And then, for anything bigger than 16 bytes,
+	is_lock_free() says false: the library hides a lock ( a small table of spin locks ) behind load() and store().
+	So every reader takes a lock again, and reads stop scaling.
+
+	seqlock ( sequence lock, also from the Linux kernel ):
+		a counter next to the data. Even => nobody is writing. Odd => a writer is in the middle of it.
+		writer:	counter++ ( odd ), write the data, counter++ ( even again )
+		reader:	read the counter, copy the data, read the counter again.
+				Same even number both times => nobody wrote in between, the copy is good. Otherwise try again.
+	Readers never write shared memory, so any number of them can read without bothering each other.
+	The price:
+		1. a reader may have to retry while writes keep coming ( fine for a snapshot written 1000s of times a second,
+		   bad for one written all the time )
+		2. the reader copies data that may be half written ( and then throws it away ). A plain struct read that races with
+		   a write is a data race => UB in C++. So the data is kept as an array of relaxed atomic words, and T is
+		   memcpy'd in and out of it. Relaxed loads / stores of a word are just normal moves on x86 and ARM.
+*/
+template <typename T>
+class seqlock {
+	static_assert(std::is_trivially_copyable_v<T>, "seqlock<T> copies T byte by byte, T must be trivially copyable");
+
+	using word = std::uint64_t;
+	static constexpr std::size_t word_count = (sizeof(T) + sizeof(word) - 1) / sizeof(word);
+
+	alignas(64) std::atomic<std::uint64_t> seq{ 0 };
+	std::atomic<word> data[word_count];
+
+	void write_words(T const& value) {
+		word words[word_count]{};
+		std::memcpy(words, &value, sizeof(T));
+		for (std::size_t i = 0; i < word_count; ++i) {
+			data[i].store(words[i], std::memory_order_relaxed);
+		}
+	}
+
+public:
+	explicit seqlock(T const& value = T{}) {
+		write_words(value);
+	}
+	seqlock(seqlock const&) = delete;
+	seqlock& operator=(seqlock const&) = delete;
+
+	T load() const {
+		word words[word_count];
+		std::uint64_t before;
+		std::uint64_t after;
+		do {
+			before = seq.load(std::memory_order_acquire);
+			while (before & 1) {
+				cpu_relax();
+				before = seq.load(std::memory_order_acquire);
+			}
+			for (std::size_t i = 0; i < word_count; ++i) {
+				words[i] = data[i].load(std::memory_order_relaxed);
+			}
+			// The data loads can't move below this fence, so "after" is read after the copy is done//
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = seq.load(std::memory_order_relaxed);
+		} while (before != after);
+		T value;
+		std::memcpy(&value, words, sizeof(T));
+		return value;
+	}
+
+	// Writers are serialised by the counter itself: only the one that turns it from even to odd may write//
+	void store(T const& value) {
+		std::uint64_t s = seq.load(std::memory_order_relaxed);
+		for (;;) {
+			if (!(s & 1) && seq.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed))
+				break;
+			cpu_relax();
+			s = seq.load(std::memory_order_relaxed);
+		}
+		// The odd counter must be visible before any of the new data is//
+		std::atomic_thread_fence(std::memory_order_release);
+		write_words(value);
+		seq.store(s + 2, std::memory_order_release);
+	}
+
+	// How many stores so far, handy to see if the snapshot changed since the last look//
+	std::uint64_t version() const { return seq.load(std::memory_order_acquire) / 2; }
+};
+
+#endif // BLK3
+
+
+
+#ifdef BLK4
+/*
+	One writer publishes quotes as fast as it can, N readers keep taking snapshots.
+	Every quote has ask == bid + 1 and ask_size == bid_size, so a reader can tell a torn ( half written ) snapshot.
+*/
+struct quote {
+	double bid;
+	double ask;
+	std::int64_t bid_size;
+	std::int64_t ask_size;
+	std::uint64_t sequence;
+	std::uint64_t timestamp;
+};
+
+quote make_quote(std::uint64_t i) {
+	double const bid = 100.0 + static_cast<double>(i % 1000) / 100;
+	return { bid, bid + 1, static_cast<std::int64_t>(i % 500), static_cast<std::int64_t>(i % 500), i, i * 3 };
+}
+
+bool torn(quote const& q) {
+	return q.ask != q.bid + 1 || q.ask_size != q.bid_size;
+}
+
+class locked_quote {
+	mutable br_lock m;
+	quote q{};
+public:
+	quote load() const {
+		std::shared_lock lk(m);
+		return q;
+	}
+	void store(quote const& value) {
+		std::lock_guard lk(m);
+		q = value;
+	}
+};
+
+constexpr int reads_per_thread = 500000;
+
+// Million snapshots per second for all readers together//
+template <typename Snapshot>
+double snapshot_throughput(int readers) {
+	Snapshot snapshot;
+	snapshot.store(make_quote(0));
+	std::atomic<bool> done{ false };
+	std::atomic<long long> torn_reads{ 0 };
+
+	std::thread writer([&]() {
+		std::uint64_t i = 1;
+		while (!done.load(std::memory_order_relaxed)) {
+			snapshot.store(make_quote(i++));
+			// A feed, not a flood: a few hundred thousand updates a second//
+			for (int spin = 0; spin < 16; ++spin) {
+				cpu_relax();
+			}
+		}
+	});
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> thread_vec{};
+	for (int r = 0; r < readers; r++) {
+		thread_vec.push_back(std::thread([&]() {
+			long long bad = 0;
+			for (int i = 0; i < reads_per_thread; ++i) {
+				bad += torn(snapshot.load());
+			}
+			torn_reads += bad;
+		}));
+	}
+	for (std::thread& t : thread_vec) {
+		t.join();
+	}
+	std::chrono::duration<double, std::micro> const us = std::chrono::steady_clock::now() - start;
+	done = true;
+	writer.join();
+	if (torn_reads != 0)
+		std::cerr << "torn snapshots: " << torn_reads << "!!!\n";
+	return readers * static_cast<double>(reads_per_thread) / us.count();
+}
+
+int main() {
+	std::atomic<quote> probe{};
+	std::cout << "sizeof(quote) = " << sizeof(quote) << ", std::atomic<quote>::is_lock_free() = " << std::boolalpha
+		<< probe.is_lock_free() << "\n";
+	std::cout << "1 writer, million snapshots per second ( " << std::thread::hardware_concurrency() << " cores )\n";
+	std::cout << std::setw(8) << "readers" << std::setw(20) << "std::atomic<quote>" << std::setw(12) << "br_lock"
+		<< std::setw(16) << "seqlock<quote>" << "\n";
+	for (int readers : { 1, 2, 4, 8, 16 }) {
+		std::cout << std::setw(8) << readers << std::fixed << std::setprecision(2)
+			<< std::setw(20) << snapshot_throughput<std::atomic<quote>>(readers)
+			<< std::setw(12) << snapshot_throughput<locked_quote>(readers)
+			<< std::setw(16) << snapshot_throughput<seqlock<quote>>(readers) << std::endl;
+	}
+}
+
+#endif // BLK4
@@ -0,0 +1,290 @@
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <atomic>
+#include <array>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
+/*
+	5.Dead_Lock_Mutex.cpp BLK3, swap(X&, X&):
+		std::scoped_lock guard(lhs.m, rhs.m);
+	scoped_lock calls std::lock(), and std::lock() has no idea which order is "right".
+	So libstdc++ does try-and-back-off:
+		lock the first one, try_lock the rest. One of them is taken? unlock EVERYTHING, start again from that one.
+	Safe, never deadlocks. But when every thread is swapping with every other thread, they keep grabbing one
+	lock each, failing on the second one, letting go, and grabbing again. Lots of work, little progress.
+	( Two people in a corridor, both stepping aside to the same side, again and again )
+
+	The old advice from note 5 BLK4: "Acquire locks in a fixed order".
+	If every thread takes the locks in the same global order, nobody can hold B while waiting for A, when somebody
+	else holds A waiting for B. No cycle => no deadlock. So there is no need to try or back off at all:
+	just lock() them one by one, in that order, and wait.
+
+	What is the global order?
+		1. the address of the mutex. Every object has one, they are all different, nothing to set up.
+		2. a rank you give the lock ( like the hierarchy level in 15.Lock_order_detector.cpp ), for when the order
+		   must mean something ( e.g. "account lock before ledger lock" ). Same rank => address decides.
+
+	ordered_lock<Mutexes...> is a drop-in for std::scoped_lock, and works for any number of locks.
+	ordered_lock_range does the same for a run-time list of locks ( a std::vector<std::mutex*> ).
+*/
+
+// ordered_lock, ranked_mutex //
+#define BLK1
+
+// Bank transfer swaps: random pairwise swap over an array of X, std::scoped_lock vs ordered_lock ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+// A mutex with a rank. Lower rank is locked first//
+template <typename Mutex = std::mutex>
+class ranked_mutex {
+	Mutex m;
+	unsigned long const r;
+public:
+	explicit ranked_mutex(unsigned long rank) : r(rank) {}
+	ranked_mutex(ranked_mutex const&) = delete;
+	ranked_mutex& operator=(ranked_mutex const&) = delete;
+	void lock() { m.lock(); }
+	bool try_lock() { return m.try_lock(); }
+	void unlock() { m.unlock(); }
+	unsigned long rank() const { return r; }
+};
+
+namespace ordering {
+	template <typename M>
+	unsigned long rank_of(M const& m) {
+		if constexpr (requires { m.rank(); })
+			return m.rank();
+		else
+			return 0;
+	}
+
+	// One lock of any type, type-erased so locks of different types can be sorted together//
+	struct entry {
+		unsigned long rank;
+		std::uintptr_t address;
+		void* m;
+		void (*lock)(void*);
+		void (*unlock)(void*);
+
+		template <typename M>
+		static entry of(M& m) {
+			return { rank_of(m), reinterpret_cast<std::uintptr_t>(&m), &m,
+				[](void* p) {static_cast<M*>(p)->lock(); },
+				[](void* p) {static_cast<M*>(p)->unlock(); } };
+		}
+	};
+	inline bool before(entry const& a, entry const& b) {
+		return a.rank != b.rank ? a.rank < b.rank : a.address < b.address;
+	}
+	inline bool same(entry const& a, entry const& b) { return a.m == b.m; }
+	inline void lock_one(entry const& e) { e.lock(e.m); }
+	inline void unlock_one(entry const& e) { e.unlock(e.m); }
+
+	// All locks of the same type ( the usual case ): plain pointers, direct calls, nothing to erase//
+	template <typename M>
+	bool before(M* a, M* b) {
+		unsigned long const ra = rank_of(*a);
+		unsigned long const rb = rank_of(*b);
+		return ra != rb ? ra < rb : std::less<M*>()(a, b);
+	}
+	template <typename M>
+	bool same(M* a, M* b) { return a == b; }
+	template <typename M>
+	void lock_one(M* m) { m->lock(); }
+	template <typename M>
+	void unlock_one(M* m) { m->unlock(); }
+
+	/*
+		Sort, drop duplicates ( swap(a, a) would otherwise lock a twice ), then lock() one by one, in order.
+		No try_lock, no back off, no retry: the order alone makes it deadlock free.
+		If a lock() throws, the ones already taken are released before the exception goes on.
+		Returns the end of the locks that are held now.
+	*/
+	template <typename It>
+	It lock_all(It first, It last) {
+		std::sort(first, last, [](auto const& a, auto const& b) {return before(a, b); });
+		last = std::unique(first, last, [](auto const& a, auto const& b) {return same(a, b); });
+		for (It it = first; it != last; ++it) {
+			try {
+				lock_one(*it);
+			}
+			catch (...) {
+				while (it != first) {
+					--it;
+					unlock_one(*it);
+				}
+				throw;
+			}
+		}
+		return last;
+	}
+
+	// Reverse order, not needed for correctness, but it's the polite thing to do//
+	template <typename It>
+	void unlock_all(It first, It last) {
+		while (last != first) {
+			--last;
+			unlock_one(*last);
+		}
+	}
+
+	template <typename First, typename... Rest>
+	struct slot_for {
+		using type = std::conditional_t<(std::is_same_v<First, Rest> && ...), First*, entry>;
+	};
+}
+
+template <typename... Mutexes>
+class ordered_lock {
+	using slot = typename ordering::slot_for<Mutexes...>::type;
+	std::array<slot, sizeof...(Mutexes)> locks;
+	typename std::array<slot, sizeof...(Mutexes)>::iterator held_end;
+
+	template <typename M>
+	static slot make_slot(M& m) {
+		if constexpr (std::is_same_v<slot, ordering::entry>)
+			return ordering::entry::of(m);
+		else
+			return &m;
+	}
+public:
+	explicit ordered_lock(Mutexes&... ms) : locks{ make_slot(ms)... } {
+		held_end = ordering::lock_all(locks.begin(), locks.end());
+	}
+	~ordered_lock() {
+		ordering::unlock_all(locks.begin(), held_end);
+	}
+	ordered_lock(ordered_lock const&) = delete;
+	ordered_lock& operator=(ordered_lock const&) = delete;
+};
+
+template <typename Mutex>
+class ordered_lock_range {
+	std::vector<Mutex*> locks;
+	typename std::vector<Mutex*>::iterator held_end;
+public:
+	explicit ordered_lock_range(std::vector<Mutex*> ms) : locks(std::move(ms)) {
+		held_end = ordering::lock_all(locks.begin(), locks.end());
+	}
+	~ordered_lock_range() {
+		ordering::unlock_all(locks.begin(), held_end);
+	}
+	ordered_lock_range(ordered_lock_range const&) = delete;
+	ordered_lock_range& operator=(ordered_lock_range const&) = delete;
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	X from 5.Dead_Lock_Mutex.cpp BLK3, with an account balance as the some_detail.
+	Threads pick two random Xs and swap them, over and over. The total never changes if the locking is right.
+	Small array => every swap fights with every other swap. Large array => collisions are rare.
+*/
+struct some_big_object {
+	long long balance;
+	long long history[7];
+};
+
+template <typename Guard>
+class X {
+private:
+	some_big_object some_detail;
+	mutable std::mutex m;
+public:
+	X(long long balance = 0) :some_detail{ balance, {} } {}
+	long long balance() const {
+		std::lock_guard lk(m);
+		return some_detail.balance;
+	}
+	friend void swap(X& lhs, X& rhs) {
+		if (&lhs == &rhs)
+			return;
+		Guard guard(lhs.m, rhs.m);
+		std::swap(lhs.some_detail, rhs.some_detail);
+	}
+};
+
+constexpr int swaps_per_thread = 200000;
+
+// Million swaps per second//
+template <typename Guard>
+double swap_throughput(std::size_t accounts, int threads) {
+	// X can't move ( the mutex can't ), deque never moves its elements//
+	std::deque<X<Guard>> xs;
+	for (std::size_t i = 0; i < accounts; ++i) {
+		xs.emplace_back(static_cast<long long>(i));
+	}
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> thread_vec{};
+	for (int t = 0; t < threads; t++) {
+		thread_vec.push_back(std::thread([&xs, accounts, t]() {
+			std::uint64_t seed = 0x9E3779B97F4A7C15ull * (t + 1);
+			for (int i = 0; i < swaps_per_thread; ++i) {
+				seed ^= seed << 13;
+				seed ^= seed >> 7;
+				seed ^= seed << 17;
+				swap(xs[seed % accounts], xs[(seed >> 32) % accounts]);
+			}
+		}));
+	}
+	for (std::thread& t : thread_vec) {
+		t.join();
+	}
+	std::chrono::duration<double, std::micro> const us = std::chrono::steady_clock::now() - start;
+	long long total = 0;
+	for (auto const& x : xs) {
+		total += x.balance();
+	}
+	if (total != static_cast<long long>(accounts * (accounts - 1) / 2))
+		std::cerr << "money lost!!!\n";
+	return threads * static_cast<double>(swaps_per_thread) / us.count();
+}
+
+int main() {
+	// Ranks first: the ledger ( rank 1 ) is always locked before the account ( rank 2 ), whatever the argument order//
+	{
+		ranked_mutex<> account(2), ledger(1);
+		ordered_lock both(account, ledger);
+		std::cout << "ranked: ledger then account, locked\n";
+	}
+	// Different mutex types in one go//
+	{
+		std::mutex a;
+		std::recursive_mutex b;
+		ranked_mutex<> c(0);
+		ordered_lock all(a, b, c);
+		std::cout << "std::mutex, std::recursive_mutex and ranked_mutex, locked\n";
+	}
+	// N locks from a list, with a duplicate in it//
+	{
+		std::vector<std::mutex> ms(5);
+		ordered_lock_range<std::mutex> all({ &ms[3], &ms[1], &ms[4], &ms[1], &ms[0], &ms[2] });
+		std::cout << "5 distinct locks out of 6 entries, locked\n";
+	}
+
+	std::cout << "random pairwise swap, million swaps per second ( " << std::thread::hardware_concurrency() << " cores )\n";
+	std::cout << std::setw(10) << "accounts" << std::setw(9) << "threads" << std::setw(19) << "std::scoped_lock"
+		<< std::setw(15) << "ordered_lock" << "\n";
+	for (std::size_t accounts : { std::size_t(16), std::size_t(1) << 16 }) {
+		for (int threads : { 2, 4, 8, 16 }) {
+			std::cout << std::setw(10) << accounts << std::setw(9) << threads << std::fixed << std::setprecision(2)
+				<< std::setw(19) << swap_throughput<std::scoped_lock<std::mutex, std::mutex>>(accounts, threads)
+				<< std::setw(15) << swap_throughput<ordered_lock<std::mutex, std::mutex>>(accounts, threads) << std::endl;
+		}
+	}
+}
+
+#endif // BLK2
@@ -0,0 +1,508 @@
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <cstdint>
+/*
+	5.Dead_Lock_Mutex.cpp BLK7:
+		"A fine_grained lock protects a small amount of data, a coarse-grained lock protects a large amount of data"
+	and then the example is ONE int behind ONE mutex. So what does fine grained look like for real?
+
+	Our shared lookup tables are the coarse-grained case: one std::unordered_map, one std::mutex.
+	Two threads looking up two completely different keys still wait for each other.
+
+	striped_hash_map, three ideas on top of each other:
+		1. Lock striping
+			The buckets are split between N stripes, every stripe has its own mutex ( on its own cache line ).
+			Bucket b belongs to stripe b % N. Writers on different stripes never meet.
+			N = 1 is the global mutex again, N = number of buckets is one lock per bucket. N is the knob.
+		2. Lock-free reads
+			find() takes no lock at all. Writers never change a node that is in the table, they build a new one
+			and swap ONE pointer ( atomic store ), so a reader always walks a consistent chain.
+			The old node can't be deleted right away ( a reader may be standing on it ), so it is retired,
+			and deleted later when no reader can see it anymore ( epoch based reclamation, see epoch_domain ).
+		3. Incremental resize
+			Growing the table usually means: lock everything, rehash everything, unlock. Stop the world.
+			Here the new table is allocated, and then every insert / erase moves a few buckets over,
+			bucket by bucket, under that bucket's stripe lock. Readers follow a "moved" flag to the new table.
+			Nobody ever waits for the whole table.
+*/
+
+// epoch_domain and striped_hash_map //
+#define BLK1
+
+// Stripe count sweep against one global mutex, and a growing table ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+/*
+	Epoch based reclamation, the short version:
+		a global epoch number, and a slot per reader thread.
+		A reader writes the current epoch in its slot when it starts, and 0 when it is done.
+		Something removed from the table is tagged with the epoch of the moment it was removed.
+		The epoch only moves from E to E+1 when every busy reader is at E.
+		So once the epoch is 2 past the tag, every reader that could have seen the thing is gone => delete it.
+	One domain for the whole program, at most max_threads threads inside a map at the same time.
+*/
+class epoch_domain {
+	static constexpr std::size_t max_threads = 256;
+	struct alignas(64) reader_slot {
+		std::atomic<std::uint64_t> epoch{ 0 };
+		std::atomic<bool> taken{ false };
+	};
+	reader_slot slots[max_threads];
+	alignas(64) std::atomic<std::uint64_t> global{ 1 };
+
+	// A thread claims a slot the first time it reads, and gives it back when it exits//
+	struct slot_owner {
+		reader_slot* slot = nullptr;
+		unsigned depth = 0;
+		~slot_owner() {
+			if (slot)
+				slot->taken.store(false, std::memory_order_release);
+		}
+	};
+	slot_owner& owner() {
+		thread_local slot_owner mine;
+		if (!mine.slot) {
+			for (reader_slot& s : slots) {
+				bool expected = false;
+				if (!s.taken.load(std::memory_order_relaxed) &&
+					s.taken.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+					mine.slot = &s;
+					break;
+				}
+			}
+			if (!mine.slot)
+				throw std::runtime_error("epoch_domain: too many threads");
+		}
+		return mine;
+	}
+
+public:
+	static epoch_domain& instance() {
+		static epoch_domain domain;
+		return domain;
+	}
+
+	// Nested guards are fine, only the outermost one counts//
+	void enter() {
+		slot_owner& me = owner();
+		if (me.depth++ == 0)
+			me.slot->epoch.store(global.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+	}
+	void exit() {
+		slot_owner& me = owner();
+		if (--me.depth == 0)
+			me.slot->epoch.store(0, std::memory_order_release);
+	}
+
+	std::uint64_t current() const { return global.load(std::memory_order_seq_cst); }
+
+	// Move the epoch on if every busy reader has caught up. Returns the epoch after trying//
+	std::uint64_t try_advance() {
+		std::uint64_t e = global.load(std::memory_order_seq_cst);
+		for (reader_slot const& s : slots) {
+			std::uint64_t const seen = s.epoch.load(std::memory_order_seq_cst);
+			if (seen != 0 && seen != e)
+				return e;
+		}
+		global.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst);
+		return global.load(std::memory_order_seq_cst);
+	}
+};
+
+class epoch_guard {
+public:
+	epoch_guard() { epoch_domain::instance().enter(); }
+	~epoch_guard() { epoch_domain::instance().exit(); }
+	epoch_guard(epoch_guard const&) = delete;
+	epoch_guard& operator=(epoch_guard const&) = delete;
+};
+
+template <typename K, typename V, typename Hash = std::hash<K>>
+class striped_hash_map {
+	// Never changed once it is in a table, only replaced//
+	struct node {
+		std::size_t const hash;
+		K const key;
+		V const value;
+		std::atomic<node*> next;
+		node(std::size_t h, K const& k, V const& v, node* n) : hash(h), key(k), value(v), next(n) {}
+	};
+
+	struct table {
+		std::size_t const mask;
+		std::unique_ptr<std::atomic<node*>[]> buckets;
+		std::unique_ptr<std::atomic<bool>[]> moved;
+		std::atomic<table*> successor{ nullptr };
+		std::atomic<std::size_t> cursor{ 0 };
+		std::atomic<std::size_t> migrated{ 0 };
+		explicit table(std::size_t size)
+			: mask(size - 1), buckets(new std::atomic<node*>[size]()), moved(new std::atomic<bool>[size]()) {}
+		std::size_t size() const { return mask + 1; }
+	};
+
+	static constexpr std::size_t max_load = 2;	// entries per bucket before the table grows//
+	static constexpr std::size_t migrate_batch = 4;	// buckets moved by every insert / erase while resizing//
+	static constexpr std::size_t collect_after = 64;
+
+	struct retired {
+		std::uint64_t epoch;
+		void* p;
+		void (*destroy)(void*);
+	};
+
+	struct alignas(64) stripe {
+		std::mutex m;
+		std::atomic<std::size_t> count{ 0 };
+		std::vector<retired> garbage;
+		std::size_t collect_at = collect_after;
+	};
+
+	Hash hasher;
+	std::size_t const stripe_mask;
+	std::unique_ptr<stripe[]> stripes;
+	alignas(64) std::atomic<table*> current;
+
+	static std::size_t round_up(std::size_t n) {
+		std::size_t p = 1;
+		while (p < n)
+			p *= 2;
+		return p;
+	}
+
+	stripe& stripe_for(std::size_t hash) const { return stripes[hash & stripe_mask]; }
+
+	/*
+		Bucket b of a table of size n becomes buckets b and b + n of the next one ( sizes are powers of two ).
+		As long as the stripe count divides n, all three belong to the same stripe.
+		So holding the stripe lock freezes bucket b in EVERY table, old or new.
+	*/
+	std::pair<table*, std::size_t> locate(std::size_t hash) const {
+		table* t = current.load(std::memory_order_acquire);
+		std::size_t b = hash & t->mask;
+		// seq_cst pairs with the store in migrate_bucket: a reader that still sees false entered before the retire stamp//
+		while (t->moved[b].load(std::memory_order_seq_cst)) {
+			t = t->successor.load(std::memory_order_acquire);
+			b = hash & t->mask;
+		}
+		return { t, b };
+	}
+
+	template <typename T>
+	void retire(stripe& s, T* p) {
+		s.garbage.push_back({ epoch_domain::instance().current(), p, [](void* q) {delete static_cast<T*>(q); } });
+		if (s.garbage.size() < s.collect_at)
+			return;
+		std::uint64_t const e = epoch_domain::instance().try_advance();
+		auto keep = std::partition(s.garbage.begin(), s.garbage.end(), [e](retired const& r) {return r.epoch + 2 > e; });
+		for (auto it = keep; it != s.garbage.end(); ++it) {
+			it->destroy(it->p);
+		}
+		s.garbage.erase(keep, s.garbage.end());
+		// A slow reader can hold the epoch back. Don't rescan the same pile on every retire while it does//
+		s.collect_at = std::max(collect_after, s.garbage.size() * 2);
+	}
+
+	void maybe_grow(stripe const& s) {
+		table* t = current.load(std::memory_order_acquire);
+		if (s.count.load(std::memory_order_relaxed) * (stripe_mask + 1) <= t->size() * max_load)
+			return;
+		if (t->successor.load(std::memory_order_acquire))
+			return;
+		auto bigger = std::make_unique<table>(t->size() * 2);
+		table* expected = nullptr;
+		if (t->successor.compare_exchange_strong(expected, bigger.get(), std::memory_order_acq_rel))
+			bigger.release();
+	}
+
+	/*
+		Copy the chain into the next table, flag the bucket, THEN retire the old nodes.
+		Retiring before the flag would stamp them with an epoch in which new readers can still walk into the old chain.
+		The old chain doesn't change meanwhile: every writer of this bucket needs s.m.
+	*/
+	void migrate_bucket(table* t, table* next, std::size_t b) {
+		stripe& s = stripes[b & stripe_mask];
+		std::lock_guard<std::mutex> lk(s.m);
+		node* const old_chain = t->buckets[b].load(std::memory_order_relaxed);
+		for (node* n = old_chain; n; n = n->next.load(std::memory_order_relaxed)) {
+			std::atomic<node*>& head = next->buckets[n->hash & next->mask];
+			head.store(new node(n->hash, n->key, n->value, head.load(std::memory_order_relaxed)), std::memory_order_release);
+		}
+		t->moved[b].store(true, std::memory_order_seq_cst);
+		for (node* n = old_chain; n; ) {
+			node* const after = n->next.load(std::memory_order_relaxed);
+			retire(s, n);
+			n = after;
+		}
+
+		if (t->migrated.fetch_add(1, std::memory_order_acq_rel) + 1 == t->size()) {
+			// Every bucket is over, the new table takes over. The old one goes when its readers are gone//
+			current.store(next, std::memory_order_release);
+			retire(s, t);
+		}
+	}
+
+	void help_resize() {
+		table* t = current.load(std::memory_order_acquire);
+		table* next = t->successor.load(std::memory_order_acquire);
+		if (!next)
+			return;
+		for (std::size_t i = 0; i < migrate_batch; ++i) {
+			std::size_t const b = t->cursor.fetch_add(1, std::memory_order_relaxed);
+			if (b >= t->size())
+				return;
+			migrate_bucket(t, next, b);
+		}
+	}
+
+public:
+	explicit striped_hash_map(std::size_t stripe_count = 64, std::size_t initial_buckets = 1024)
+		: stripe_mask(round_up(stripe_count) - 1), stripes(new stripe[round_up(stripe_count)]),
+		current(new table(std::max(round_up(initial_buckets), round_up(stripe_count)))) {}
+	striped_hash_map(striped_hash_map const&) = delete;
+	striped_hash_map& operator=(striped_hash_map const&) = delete;
+
+	// No other thread may be using the map now//
+	~striped_hash_map() {
+		table* t = current.load();
+		while (t) {
+			for (std::size_t b = 0; b < t->size(); ++b) {
+				if (t->moved[b].load())
+					continue;
+				for (node* n = t->buckets[b].load(); n; ) {
+					node* const after = n->next.load();
+					delete n;
+					n = after;
+				}
+			}
+			table* const next = t->successor.load();
+			delete t;
+			t = next;
+		}
+		for (std::size_t i = 0; i <= stripe_mask; ++i) {
+			for (retired const& r : stripes[i].garbage) {
+				r.destroy(r.p);
+			}
+		}
+	}
+
+	// No lock. The value is copied out, the node may be retired right after//
+	std::optional<V> find(K const& key) const {
+		epoch_guard guard;
+		std::size_t const hash = hasher(key);
+		auto [t, b] = locate(hash);
+		for (node* n = t->buckets[b].load(std::memory_order_acquire); n; n = n->next.load(std::memory_order_acquire)) {
+			if (n->hash == hash && n->key == key)
+				return n->value;
+		}
+		return std::nullopt;
+	}
+
+	bool contains(K const& key) const { return find(key).has_value(); }
+
+	// true if the key is new, false if an old value was replaced//
+	bool insert_or_assign(K const& key, V const& value) {
+		epoch_guard guard;
+		std::size_t const hash = hasher(key);
+		stripe& s = stripe_for(hash);
+		bool inserted = true;
+		{
+			std::lock_guard<std::mutex> lk(s.m);
+			auto [t, b] = locate(hash);
+			std::atomic<node*>* link = &t->buckets[b];
+			for (node* n = link->load(std::memory_order_relaxed); n; link = &n->next, n = link->load(std::memory_order_relaxed)) {
+				if (n->hash == hash && n->key == key) {
+					link->store(new node(hash, key, value, n->next.load(std::memory_order_relaxed)), std::memory_order_release);
+					retire(s, n);
+					inserted = false;
+					break;
+				}
+			}
+			if (inserted) {
+				std::atomic<node*>& head = t->buckets[b];
+				head.store(new node(hash, key, value, head.load(std::memory_order_relaxed)), std::memory_order_release);
+				s.count.fetch_add(1, std::memory_order_relaxed);
+				maybe_grow(s);
+			}
+		}
+		help_resize();
+		return inserted;
+	}
+
+	bool erase(K const& key) {
+		epoch_guard guard;
+		std::size_t const hash = hasher(key);
+		stripe& s = stripe_for(hash);
+		bool erased = false;
+		{
+			std::lock_guard<std::mutex> lk(s.m);
+			auto [t, b] = locate(hash);
+			std::atomic<node*>* link = &t->buckets[b];
+			for (node* n = link->load(std::memory_order_relaxed); n; link = &n->next, n = link->load(std::memory_order_relaxed)) {
+				if (n->hash == hash && n->key == key) {
+					link->store(n->next.load(std::memory_order_relaxed), std::memory_order_release);
+					retire(s, n);
+					s.count.fetch_sub(1, std::memory_order_relaxed);
+					erased = true;
+					break;
+				}
+			}
+		}
+		help_resize();
+		return erased;
+	}
+
+	// Exact when nobody is writing, a snapshot-ish number otherwise//
+	std::size_t size() const {
+		std::size_t n = 0;
+		for (std::size_t i = 0; i <= stripe_mask; ++i) {
+			n += stripes[i].count.load(std::memory_order_relaxed);
+		}
+		return n;
+	}
+	std::size_t bucket_count() const {
+		epoch_guard guard;
+		return current.load(std::memory_order_acquire)->size();
+	}
+	std::size_t stripe_count() const { return stripe_mask + 1; }
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	The coarse-grained version: what our lookup tables are today//
+*/
+template <typename K, typename V>
+class global_mutex_map {
+	mutable std::mutex m;
+	std::unordered_map<K, V> map;
+public:
+	std::optional<V> find(K const& key) const {
+		std::lock_guard<std::mutex> lk(m);
+		auto it = map.find(key);
+		if (it == map.end())
+			return std::nullopt;
+		return it->second;
+	}
+	bool insert_or_assign(K const& key, V const& value) {
+		std::lock_guard<std::mutex> lk(m);
+		return map.insert_or_assign(key, value).second;
+	}
+	bool erase(K const& key) {
+		std::lock_guard<std::mutex> lk(m);
+		return map.erase(key) == 1;
+	}
+};
+
+constexpr int ops_per_thread = 200000;
+constexpr std::uint64_t key_space = 1 << 16;
+
+// 90% find, 5% insert, 5% erase. Million operations per second//
+template <typename Map>
+double lookup_throughput(Map& map, int threads) {
+	for (std::uint64_t k = 0; k < key_space; k += 2) {
+		map.insert_or_assign(k, k * 10);
+	}
+	std::atomic<long long> wrong{ 0 };
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> thread_vec{};
+	for (int t = 0; t < threads; t++) {
+		thread_vec.push_back(std::thread([&map, &wrong, t]() {
+			std::uint64_t seed = 0x9E3779B97F4A7C15ull * (t + 1);
+			long long bad = 0;
+			for (int i = 0; i < ops_per_thread; ++i) {
+				seed ^= seed << 13;
+				seed ^= seed >> 7;
+				seed ^= seed << 17;
+				std::uint64_t const key = (seed >> 16) % key_space;
+				std::uint64_t const dice = seed % 100;
+				if (dice < 90) {
+					std::optional<std::uint64_t> v = map.find(key);
+					bad += v && *v != key * 10;
+				}
+				else if (dice < 95) {
+					map.insert_or_assign(key, key * 10);
+				}
+				else {
+					map.erase(key);
+				}
+			}
+			wrong += bad;
+		}));
+	}
+	for (std::thread& t : thread_vec) {
+		t.join();
+	}
+	std::chrono::duration<double, std::micro> const us = std::chrono::steady_clock::now() - start;
+	if (wrong != 0)
+		std::cerr << "wrong values: " << wrong << "!!!\n";
+	return threads * static_cast<double>(ops_per_thread) / us.count();
+}
+
+int main() {
+	int const threads = 8;
+	std::cout << threads << " threads, 90% find / 5% insert / 5% erase, million ops per second ( "
+		<< std::thread::hardware_concurrency() << " cores )\n";
+	{
+		global_mutex_map<std::uint64_t, std::uint64_t> map;
+		std::cout << std::setw(24) << "global mutex" << std::fixed << std::setprecision(2)
+			<< std::setw(10) << lookup_throughput(map, threads) << "\n";
+	}
+	for (std::size_t stripes : { 1, 4, 16, 64, 256 }) {
+		striped_hash_map<std::uint64_t, std::uint64_t> map(stripes, 1 << 15);
+		std::cout << std::setw(16) << stripes << " stripes" << std::setw(10) << lookup_throughput(map, threads) << std::endl;
+	}
+
+	// Growing from 16 buckets while 4 threads insert and 4 threads read: no stop the world//
+	{
+		striped_hash_map<std::uint64_t, std::uint64_t> map(16, 16);
+		constexpr std::uint64_t per_thread = 50000;
+		std::atomic<bool> done{ false };
+		std::atomic<long long> found{ 0 };
+		std::vector<std::thread> thread_vec{};
+		for (std::uint64_t t = 0; t < 4; ++t) {
+			thread_vec.push_back(std::thread([&map, t]() {
+				for (std::uint64_t i = 0; i < per_thread; ++i) {
+					map.insert_or_assign(t * per_thread + i, i);
+				}
+			}));
+			thread_vec.push_back(std::thread([&map, &done, &found]() {
+				long long mine = 0;
+				for (std::uint64_t k = 0; !done.load(std::memory_order_relaxed); k = (k + 7919) % (4 * per_thread)) {
+					mine += map.contains(k);
+				}
+				found += mine;
+			}));
+		}
+		for (std::size_t i = 0; i < thread_vec.size(); i += 2) {
+			thread_vec[i].join();
+		}
+		done = true;
+		for (std::size_t i = 1; i < thread_vec.size(); i += 2) {
+			thread_vec[i].join();
+		}
+		std::uint64_t missing = 0;
+		for (std::uint64_t k = 0; k < 4 * per_thread; ++k) {
+			missing += !map.contains(k);
+		}
+		std::cout << "grown to " << map.bucket_count() << " buckets, size " << map.size() << ", missing " << missing
+			<< ", hits while growing " << found << std::endl;
+	}
+}
+
+#endif // BLK2
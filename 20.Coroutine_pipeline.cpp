@@ -0,0 +1,534 @@
+#include <thread>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <vector>
+#include <optional>
+#include <exception>
+#include <stdexcept>
+#include <system_error>
+#include <latch>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+/*
+	6.Sharing_data_between_threads.cpp BLK2:
+		data_preparation_thread()	=> while (more_data_to_prepare()) { push, notify_one }
+		data_processing_thread()	=> while (true) { wait on the condition variable, pop, process }
+	Each loop owns a whole OS thread, and spends almost all of its life asleep in wait().
+	One pipeline = two threads. 10k pipelines = 20k threads, 20k stacks,
+	and every hand-off between them is a trip through the kernel scheduler ( a context switch ).
+
+	C++20 coroutines: a function that can stop in the middle ( co_await ), and be resumed later, by anybody.
+	When it stops, it doesn't keep a thread. Its locals live in a small heap frame ( a few hundred bytes, not 8 MB ).
+	So "waiting for the next chunk" costs nothing but that frame, and the hand-off is a function call in user space.
+
+	What the standard gives us is only the machinery. This note builds the three pieces we need:
+		1. task<T>		=> a coroutine that returns a T. co_await it to start it and get the T ( or its exception ).
+		2. executor		=> a handful of threads that resume coroutines. Like the thread pool of note 9, for coroutines.
+		3. channel<T>	=> the data_queue + data_cond of BLK2, as an awaitable:
+							co_await ch.send(chunk)			suspends while the channel is full
+							co_await ch.receive()			suspends while it is empty, nullopt once it is closed
+*/
+
+// task<T>, executor, channel<T> //
+#define BLK1
+
+// 10k data_preparation / data_processing pipelines: coroutines on an executor vs thread per stage ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+class executor {
+	std::mutex mut;
+	std::condition_variable cond;
+	std::deque<std::coroutine_handle<>> ready;
+	bool stopping = false;
+	std::vector<std::thread> threads;
+
+	void worker_loop() {
+		for (;;) {
+			std::coroutine_handle<> h;
+			{
+				std::unique_lock<std::mutex> lk(mut);
+				cond.wait(lk, [this] {return stopping || !ready.empty(); });
+				if (ready.empty())
+					return;
+				h = ready.front();
+				ready.pop_front();
+			}
+			h.resume();
+		}
+	}
+
+public:
+	explicit executor(std::size_t thread_count = std::thread::hardware_concurrency()) {
+		if (thread_count == 0)
+			thread_count = 1;
+		for (std::size_t i = 0; i < thread_count; ++i) {
+			threads.emplace_back(&executor::worker_loop, this);
+		}
+	}
+	// Runs what is already queued, then joins//
+	~executor() {
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			stopping = true;
+		}
+		cond.notify_all();
+		for (std::thread& t : threads) {
+			t.join();
+		}
+	}
+	executor(executor const&) = delete;
+	executor& operator=(executor const&) = delete;
+
+	std::size_t size() const { return threads.size(); }
+
+	void post(std::coroutine_handle<> h) {
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			ready.push_back(h);
+		}
+		cond.notify_one();
+	}
+
+	// co_await ex.schedule() => the rest of the coroutine runs on one of ex's threads//
+	auto schedule() {
+		struct awaiter {
+			executor* ex;
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> h) { ex->post(h); }
+			void await_resume() const noexcept {}
+		};
+		return awaiter{ this };
+	}
+};
+
+template <typename T = void>
+class task;
+
+namespace task_detail {
+	// When a task finishes, jump straight into whoever was co_awaiting it ( no trip through the executor )//
+	struct final_awaiter {
+		bool await_ready() const noexcept { return false; }
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+			if (std::coroutine_handle<> next = h.promise().continuation)
+				return next;
+			return std::noop_coroutine();
+		}
+		void await_resume() const noexcept {}
+	};
+
+	struct promise_base {
+		std::coroutine_handle<> continuation;
+		std::exception_ptr error;
+		// Lazy: nothing runs until somebody co_awaits the task//
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		final_awaiter final_suspend() noexcept { return {}; }
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+
+	template <typename T>
+	struct promise : promise_base {
+		std::optional<T> value;
+		task<T> get_return_object();
+		template <typename U>
+		void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+		T result() {
+			if (error)
+				std::rethrow_exception(error);
+			return std::move(*value);
+		}
+	};
+
+	template <>
+	struct promise<void> : promise_base {
+		task<void> get_return_object();
+		void return_void() {}
+		void result() {
+			if (error)
+				std::rethrow_exception(error);
+		}
+	};
+}
+
+template <typename T>
+class task {
+public:
+	using promise_type = task_detail::promise<T>;
+
+private:
+	std::coroutine_handle<promise_type> h;
+
+public:
+	explicit task(std::coroutine_handle<promise_type> handle) : h(handle) {}
+	task(task&& other) noexcept : h(std::exchange(other.h, {})) {}
+	task& operator=(task&& other) noexcept {
+		if (this != &other) {
+			if (h)
+				h.destroy();
+			h = std::exchange(other.h, {});
+		}
+		return *this;
+	}
+	task(task const&) = delete;
+	task& operator=(task const&) = delete;
+	~task() {
+		if (h)
+			h.destroy();
+	}
+
+	auto operator co_await() && noexcept {
+		struct awaiter {
+			std::coroutine_handle<promise_type> h;
+			bool await_ready() const noexcept { return !h || h.done(); }
+			// Start the task, and remember who to come back to//
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+				h.promise().continuation = awaiting;
+				return h;
+			}
+			T await_resume() { return h.promise().result(); }
+		};
+		return awaiter{ h };
+	}
+};
+
+template <typename T>
+task<T> task_detail::promise<T>::get_return_object() {
+	return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+inline task<void> task_detail::promise<void>::get_return_object() {
+	return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+namespace task_detail {
+	// Nobody waits for it, it frees itself when done. An exception here has nowhere to go => std::terminate//
+	struct detached {
+		struct promise_type {
+			detached get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	inline detached run_detached(executor& ex, task<void> t) {
+		co_await ex.schedule();
+		co_await std::move(t);
+	}
+}
+
+// Start t on the executor, fire and forget. Use a latch ( or a channel ) to know when it's done//
+inline void spawn(executor& ex, task<void> t) {
+	task_detail::run_detached(ex, std::move(t));
+}
+
+/*
+	A bounded channel. Same rules as the queue + condition variable, but a waiting coroutine is just a handle in a list.
+	Whoever makes a waiter runnable hands it back to the executor ( not resumed inline, we are holding the lock ).
+	capacity 0 is fine too: then every send waits for a receive ( a rendezvous ).
+*/
+template <typename T>
+class channel {
+	struct send_waiter {
+		T value;
+		std::coroutine_handle<> h;
+		bool closed = false;
+	};
+	struct receive_waiter {
+		std::optional<T> value;
+		std::coroutine_handle<> h;
+	};
+
+	executor& ex;
+	std::size_t const capacity;
+	std::mutex mut;
+	std::deque<T> buffer;
+	std::deque<send_waiter*> senders;
+	std::deque<receive_waiter*> receivers;
+	bool closed = false;
+
+public:
+	channel(executor& e, std::size_t cap) : ex(e), capacity(cap) {}
+	channel(channel const&) = delete;
+	channel& operator=(channel const&) = delete;
+
+	auto send(T value) {
+		struct awaiter {
+			channel* ch;
+			send_waiter w;
+			bool await_ready() const noexcept { return false; }
+			bool await_suspend(std::coroutine_handle<> h) {
+				std::unique_lock<std::mutex> lk(ch->mut);
+				if (ch->closed) {
+					w.closed = true;
+					return false;
+				}
+				// Somebody is already waiting: give it the value directly//
+				if (!ch->receivers.empty()) {
+					receive_waiter* r = ch->receivers.front();
+					ch->receivers.pop_front();
+					r->value.emplace(std::move(w.value));
+					lk.unlock();
+					ch->ex.post(r->h);
+					return false;
+				}
+				if (ch->buffer.size() < ch->capacity) {
+					ch->buffer.push_back(std::move(w.value));
+					return false;
+				}
+				w.h = h;
+				ch->senders.push_back(&w);
+				return true;
+			}
+			void await_resume() {
+				if (w.closed)
+					throw std::runtime_error("send on a closed channel");
+			}
+		};
+		return awaiter{ this, send_waiter{ std::move(value), {} } };
+	}
+
+	auto receive() {
+		struct awaiter {
+			channel* ch;
+			receive_waiter w;
+			bool await_ready() const noexcept { return false; }
+			bool await_suspend(std::coroutine_handle<> h) {
+				std::unique_lock<std::mutex> lk(ch->mut);
+				send_waiter* s = nullptr;
+				if (!ch->buffer.empty()) {
+					w.value.emplace(std::move(ch->buffer.front()));
+					ch->buffer.pop_front();
+					// Room in the buffer now, let the first blocked sender in//
+					if (!ch->senders.empty()) {
+						s = ch->senders.front();
+						ch->senders.pop_front();
+						ch->buffer.push_back(std::move(s->value));
+					}
+				}
+				else if (!ch->senders.empty()) {
+					s = ch->senders.front();
+					ch->senders.pop_front();
+					w.value.emplace(std::move(s->value));
+				}
+				else if (!ch->closed) {
+					w.h = h;
+					ch->receivers.push_back(&w);
+					return true;
+				}
+				lk.unlock();
+				if (s)
+					ch->ex.post(s->h);
+				return false;
+			}
+			// nullopt => closed, and everything sent before close() has been received//
+			std::optional<T> await_resume() { return std::move(w.value); }
+		};
+		return awaiter{ this, receive_waiter{} };
+	}
+
+	// Waiting receivers get nullopt, waiting and future senders get an exception//
+	void close() {
+		std::deque<send_waiter*> s;
+		std::deque<receive_waiter*> r;
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			closed = true;
+			s.swap(senders);
+			r.swap(receivers);
+		}
+		for (send_waiter* w : s) {
+			w->closed = true;
+			ex.post(w->h);
+		}
+		for (receive_waiter* w : r) {
+			ex.post(w->h);
+		}
+	}
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	The BLK2 pipeline from note 6, made concrete:
+		data_preparation	=> produces chunks_per_pipeline chunks, then says "that was the last one"
+		data_processing		=> processes every chunk ( sums it up ) until it sees the last one
+	Thread version: exactly the code from note 6, one queue + mutex + condition variable per pipeline, two threads.
+	Coroutine version: one channel per pipeline, two coroutines, all of them on one executor.
+*/
+constexpr int pipelines = 10000;
+constexpr int chunks_per_pipeline = 20;
+
+struct data_chunk {
+	int id;
+	int payload[15];
+	bool last;
+};
+
+data_chunk prepare_data(int id, bool last) {
+	data_chunk c{ id, {}, last };
+	for (int i = 0; i < 15; ++i) {
+		c.payload[i] = id + i;
+	}
+	return c;
+}
+
+long long process(data_chunk const& data) {
+	long long sum = 0;
+	for (int v : data.payload) {
+		sum += v;
+	}
+	return sum;
+}
+
+task<void> data_preparation(channel<data_chunk>& ch, std::latch& done) {
+	for (int i = 0; i < chunks_per_pipeline; ++i) {
+		co_await ch.send(prepare_data(i, i == chunks_per_pipeline - 1));
+	}
+	ch.close();
+	done.count_down();
+}
+
+task<long long> process_all(channel<data_chunk>& ch) {
+	long long total = 0;
+	while (std::optional<data_chunk> data = co_await ch.receive()) {
+		total += process(*data);
+		if (data->last)
+			break;
+	}
+	co_return total;
+}
+
+// A task can co_await another task, the value comes back like a function call//
+task<void> data_processing(channel<data_chunk>& ch, std::atomic<long long>& grand_total, std::latch& done) {
+	grand_total.fetch_add(co_await process_all(ch), std::memory_order_relaxed);
+	done.count_down();
+}
+
+struct thread_pipeline {
+	std::mutex mut;
+	std::deque<data_chunk> data_queue;
+	std::condition_variable data_cond;
+};
+
+void data_preparation_thread(thread_pipeline& p) {
+	for (int i = 0; i < chunks_per_pipeline; ++i) {
+		data_chunk const data = prepare_data(i, i == chunks_per_pipeline - 1);
+		{
+			std::lock_guard<std::mutex> lk(p.mut);
+			p.data_queue.push_back(data);
+		}
+		p.data_cond.notify_one();
+	}
+}
+
+void data_processing_thread(thread_pipeline& p, std::atomic<long long>& grand_total) {
+	long long total = 0;
+	while (true) {
+		std::unique_lock<std::mutex> lk(p.mut);
+		p.data_cond.wait(lk, [&p] {return !p.data_queue.empty(); });
+		data_chunk data = p.data_queue.front();
+		p.data_queue.pop_front();
+		lk.unlock();
+		total += process(data);
+		if (data.last)
+			break;
+	}
+	grand_total.fetch_add(total, std::memory_order_relaxed);
+}
+
+// Voluntary + involuntary context switches of the whole process so far//
+long context_switches() {
+#if defined(__linux__)
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_nvcsw + usage.ru_nivcsw;
+#else
+	return -1;
+#endif
+}
+
+int main() {
+	auto ms = [](auto d) {return std::chrono::duration<double, std::milli>(d).count(); };
+	long long const expected = static_cast<long long>(pipelines) * [] {
+		long long s = 0;
+		for (int i = 0; i < chunks_per_pipeline; ++i) {
+			s += process(prepare_data(i, false));
+		}
+		return s;
+	}();
+
+	// Coroutines: 20k coroutines, one executor thread per core//
+	{
+		std::atomic<long long> grand_total{ 0 };
+		// Both stages count down: the channels may only go away when nobody is touching them//
+		std::latch done(2 * pipelines);
+		long const switches_before = context_switches();
+		auto start = std::chrono::steady_clock::now();
+		{
+			executor ex;
+			std::deque<channel<data_chunk>> channels;
+			for (int i = 0; i < pipelines; ++i) {
+				channel<data_chunk>& ch = channels.emplace_back(ex, 4);
+				spawn(ex, data_processing(ch, grand_total, done));
+				spawn(ex, data_preparation(ch, done));
+			}
+			done.wait();
+			std::cout << pipelines << " pipelines as coroutines on " << ex.size() << " threads: ";
+		}
+		std::cout << ms(std::chrono::steady_clock::now() - start) << " ms, " << context_switches() - switches_before
+			<< " context switches" << (grand_total == expected ? "" : ", WRONG TOTAL!!!") << "\n";
+	}
+
+	// Thread per stage: 20k threads. The OS may refuse before we get there//
+	{
+		std::atomic<long long> grand_total{ 0 };
+		std::deque<thread_pipeline> pipes;
+		std::vector<std::thread> threads;
+		threads.reserve(2 * pipelines);
+		long const switches_before = context_switches();
+		auto start = std::chrono::steady_clock::now();
+		int started = 0;
+		try {
+			for (; started < pipelines; ++started) {
+				thread_pipeline& p = pipes.emplace_back();
+				threads.emplace_back(data_processing_thread, std::ref(p), std::ref(grand_total));
+				try {
+					threads.emplace_back(data_preparation_thread, std::ref(p));
+				}
+				catch (...) {
+					// Don't leave a consumer waiting for a producer that never came//
+					{
+						std::lock_guard<std::mutex> lk(p.mut);
+						p.data_queue.push_back(prepare_data(0, true));
+					}
+					p.data_cond.notify_one();
+					throw;
+				}
+			}
+		}
+		catch (std::system_error const& e) {
+			std::cout << "the OS refused thread number " << threads.size() + 1 << ": " << e.what() << "\n";
+		}
+		for (std::thread& t : threads) {
+			t.join();
+		}
+		std::cout << started << " pipelines as " << threads.size() << " threads: "
+			<< ms(std::chrono::steady_clock::now() - start) << " ms, " << context_switches() - switches_before
+			<< " context switches" << (started < pipelines || grand_total == expected ? "" : ", WRONG TOTAL!!!") << std::endl;
+	}
+}
+
+#endif // BLK2
@@ -0,0 +1,462 @@
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <barrier>
+#include <memory>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <filesystem>
+#include <system_error>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+/*
+	6.Sharing_data_between_threads.cpp BLK6:
+		std::barrier my_barr(2, []() noexcept {puts("Green Light is on. Go ahead!"); });
+	Two threads, no problem. But every arrive_and_wait() is a fetch_sub on ONE counter.
+	64 threads arriving at once => 64 atomic operations on the same cache line, one after the other,
+	the line travelling from core to core ( and from socket to socket ) every time.
+	An iterative solver hits the barrier thousands of times a second, so that is where the time goes.
+	( 64 people signing out on the same sheet of paper at the door )
+
+	Combining tree barrier:
+		threads are split into small groups, every group has its own counter ( a leaf of the tree, own cache line ).
+		The last thread to arrive at a leaf carries the arrival one level up, to the parent counter. And so on.
+		The last one at the root ran the whole race: it calls the completion function and opens the gate.
+		Every counter only sees a handful of threads => short queues on every cache line.
+
+	NUMA grouping:
+		on a box with two sockets, a cache line owned by the other socket is much slower to get.
+		So the tree is built so that no counter below the top mixes two NUMA nodes: a socket's threads combine
+		among themselves first, and only ONE arrival per socket crosses over.
+		( Slot i belongs to CPU i: a thread's first arrive takes the slot of the CPU it is on.
+		  That only holds if the thread stays there, so pin them like 14.Thread_group.cpp does, to CPUs we are allowed on )
+
+	Same API as std::barrier:
+		arrive_and_wait(), arrive_and_drop(), arrive() + wait(token), and a noexcept completion function.
+	One difference: a participant is a thread. The first arrive of a thread gives it a slot in the tree, for good.
+	( or pass the participant index yourself: arrive_and_wait(i) )
+*/
+
+// tree_barrier //
+#define BLK1
+
+// The BLK6 example from note 6, and phases per second against std::barrier ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+// "0-15,32-47" => 0, 1, ... 15, 32, 33, ... 47//
+inline std::vector<unsigned> parse_cpu_list(std::string const& list) {
+	std::vector<unsigned> cpus;
+	std::stringstream ranges(list);
+	std::string range;
+	while (std::getline(ranges, range, ',')) {
+		if (range.empty())
+			continue;
+		std::size_t const dash = range.find('-');
+		unsigned const lo = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+		unsigned const hi = dash == std::string::npos ? lo : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+		for (unsigned c = lo; c <= hi; ++c) {
+			cpus.push_back(c);
+		}
+	}
+	return cpus;
+}
+
+/*
+	CPU id -> NUMA node, from every /sys/devices/system/node/nodeN/cpulist.
+	The cpus of a node don't have to be one range ( "0-15,32-47" on a box with hyper threads ), so no shortcuts.
+	Empty when we can't tell ( not linux ) or there is only one node: then everybody is on node 0.
+*/
+inline std::vector<int> numa_node_of_cpu() {
+	std::vector<int> node_of;
+#if defined(__linux__)
+	int nodes = 0;
+	std::error_code ec;
+	for (auto const& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+		std::string const name = entry.path().filename().string();
+		if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+			!std::all_of(name.begin() + 4, name.end(), [](char c) {return c >= '0' && c <= '9'; }))
+			continue;
+		std::ifstream file(entry.path() / "cpulist");
+		std::string list;
+		if (!std::getline(file, list))
+			continue;
+		int const node = std::stoi(name.substr(4));
+		for (unsigned cpu : parse_cpu_list(list)) {
+			if (cpu >= node_of.size())
+				node_of.resize(cpu + 1, 0);
+			node_of[cpu] = node;
+		}
+		++nodes;
+	}
+	if (nodes < 2)
+		node_of.clear();
+#endif
+	return node_of;
+}
+
+inline int current_cpu() {
+#if defined(__linux__)
+	return sched_getcpu();
+#else
+	return -1;
+#endif
+}
+
+// The allowed_cpus() from 14.Thread_group.cpp: the CPU ids we may run on. Under taskset / a cpuset that can be 4-7//
+inline std::vector<unsigned> allowed_cpus() {
+	std::vector<unsigned> cpus;
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (unsigned c = 0; c < CPU_SETSIZE; ++c) {
+			if (CPU_ISSET(c, &set))
+				cpus.push_back(c);
+		}
+	}
+#endif
+	// Can't tell: assume 0 .. n-1//
+	if (cpus.empty()) {
+		unsigned const n = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned c = 0; c < n; ++c) {
+			cpus.push_back(c);
+		}
+	}
+	return cpus;
+}
+
+// Best effort, like 14.Thread_group.cpp: if the OS says no, the thread just runs unpinned. core is a real CPU id//
+inline bool pin_this_thread(unsigned core) {
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)core;
+	return false;
+#endif
+}
+
+struct no_completion {
+	void operator()() noexcept {}
+};
+
+template <typename Completion = no_completion>
+class tree_barrier {
+	static_assert(std::is_nothrow_invocable_v<Completion&>, "the completion function must be noexcept, like std::barrier's");
+
+	static constexpr std::size_t no_parent = static_cast<std::size_t>(-1);
+
+	struct alignas(64) node {
+		std::atomic<std::uint32_t> arrived{ 0 };
+		std::atomic<std::uint32_t> expected{ 0 };
+		// Arrivals this phase that won't come back next phase ( arrive_and_drop )//
+		std::atomic<std::uint32_t> drops{ 0 };
+		std::size_t parent = no_parent;
+	};
+
+	std::unique_ptr<node[]> nodes;
+	std::size_t node_count = 0;
+	std::vector<int> const node_of_cpu;
+	std::vector<std::size_t> leaf_of;	// participant -> leaf//
+	std::vector<int> slot_node;			// participant -> NUMA node//
+	std::unique_ptr<std::atomic<bool>[]> taken;
+	std::size_t const participants;
+	Completion completion;
+	alignas(64) std::atomic<std::uint32_t> phase{ 0 };
+	std::uint64_t const id;
+
+	static std::uint64_t next_id() {
+		static std::atomic<std::uint64_t> counter{ 0 };
+		return counter.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/*
+		Slot i belongs to CPU i ( my_slot() hands it out that way ), so slot i sits on node_of_cpu[i].
+		Build bottom up. Leaves take up to group_size slots of ONE node. Above them, children are grouped fan_in at a
+		time, again never across a node, until there is one group per node. Only the levels above that mix nodes.
+	*/
+	void build(std::size_t group_size, std::size_t fan_in) {
+		struct proto {
+			int numa;
+			std::vector<std::size_t> members;	// slots for a leaf, protos of the level below otherwise//
+		};
+		std::vector<std::vector<proto>> levels;
+
+		std::vector<std::size_t> order(participants);
+		std::iota(order.begin(), order.end(), std::size_t(0));
+		std::stable_sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) {return slot_node[a] < slot_node[b]; });
+
+		std::vector<proto> leaves;
+		for (std::size_t slot : order) {
+			if (leaves.empty() || leaves.back().numa != slot_node[slot] || leaves.back().members.size() >= group_size)
+				leaves.push_back({ slot_node[slot], {} });
+			leaves.back().members.push_back(slot);
+		}
+		levels.push_back(std::move(leaves));
+
+		while (levels.back().size() > 1) {
+			std::vector<proto> const& below = levels.back();
+			// Once every NUMA node is down to one group, mix them//
+			bool one_per_numa = true;
+			for (std::size_t i = 1; i < below.size(); ++i) {
+				if (below[i].numa == below[i - 1].numa)
+					one_per_numa = false;
+			}
+			std::vector<proto> above;
+			for (std::size_t i = 0; i < below.size(); ++i) {
+				if (above.empty() || above.back().members.size() >= fan_in || (!one_per_numa && above.back().numa != below[i].numa))
+					above.push_back({ below[i].numa, {} });
+				above.back().members.push_back(i);
+			}
+			levels.push_back(std::move(above));
+		}
+
+		// Flatten: level by level, remember where every level starts//
+		std::vector<std::size_t> level_start;
+		for (auto const& level : levels) {
+			level_start.push_back(node_count);
+			node_count += level.size();
+		}
+		nodes.reset(new node[node_count]);
+		for (std::size_t l = 0; l < levels.size(); ++l) {
+			for (std::size_t i = 0; i < levels[l].size(); ++i) {
+				node& n = nodes[level_start[l] + i];
+				n.expected.store(static_cast<std::uint32_t>(levels[l][i].members.size()), std::memory_order_relaxed);
+				if (l > 0) {
+					for (std::size_t child : levels[l][i].members) {
+						nodes[level_start[l - 1] + child].parent = level_start[l] + i;
+					}
+				}
+			}
+		}
+		leaf_of.resize(participants);
+		for (std::size_t i = 0; i < levels[0].size(); ++i) {
+			for (std::size_t slot : levels[0][i].members) {
+				leaf_of[slot] = i;
+			}
+		}
+	}
+
+	bool claim(std::size_t slot) {
+		return !taken[slot].exchange(true, std::memory_order_relaxed);
+	}
+
+	/*
+		The slot of the calling thread in THIS barrier, handed out on its first arrival.
+		First choice: the slot of the CPU we run on. Then any slot of the same node, then any slot at all.
+		( Only means something when the thread stays on that CPU: pin it )
+	*/
+	std::size_t my_slot() {
+		thread_local std::vector<std::pair<std::uint64_t, std::size_t>> slots;
+		for (auto const& s : slots) {
+			if (s.first == id)
+				return s.second;
+		}
+		int const cpu = current_cpu();
+		std::size_t slot = participants;
+		if (cpu >= 0 && static_cast<std::size_t>(cpu) < participants && claim(static_cast<std::size_t>(cpu)))
+			slot = static_cast<std::size_t>(cpu);
+		int const numa = cpu >= 0 && static_cast<std::size_t>(cpu) < node_of_cpu.size() ? node_of_cpu[cpu] : 0;
+		for (std::size_t i = 0; slot == participants && i < participants; ++i) {
+			if (slot_node[i] == numa && claim(i))
+				slot = i;
+		}
+		for (std::size_t i = 0; slot == participants && i < participants; ++i) {
+			if (claim(i))
+				slot = i;
+		}
+		if (slot == participants)
+			throw std::logic_error("tree_barrier: more threads than participants");
+		slots.push_back({ id, slot });
+		return slot;
+	}
+
+	std::uint32_t arrive_at(std::size_t participant, bool drop) {
+		std::uint32_t const token = phase.load(std::memory_order_acquire);
+		std::size_t i = leaf_of[participant];
+		for (;;) {
+			node& n = nodes[i];
+			if (drop)
+				n.drops.fetch_add(1, std::memory_order_relaxed);
+			if (n.arrived.fetch_add(1, std::memory_order_acq_rel) + 1 != n.expected.load(std::memory_order_relaxed))
+				return token;
+			// Last one here. Nobody else touches this node until the gate opens, so plain resets are fine//
+			n.arrived.store(0, std::memory_order_relaxed);
+			std::uint32_t const left = n.expected.load(std::memory_order_relaxed) - n.drops.exchange(0, std::memory_order_relaxed);
+			n.expected.store(left, std::memory_order_relaxed);
+			// A subtree with nobody left drops out of its parent too//
+			drop = left == 0;
+			if (n.parent == no_parent)
+				break;
+			i = n.parent;
+		}
+		completion();
+		phase.store(token + 1, std::memory_order_release);
+		phase.notify_all();
+		return token;
+	}
+
+public:
+	using arrival_token = std::uint32_t;
+
+	/*
+		group_size	=> participants per leaf counter
+		fan_in		=> children per counter above the leaves
+		node_of_cpu	=> NUMA node of every CPU id, detected by default ( empty = one node )
+	*/
+	explicit tree_barrier(std::size_t expected, Completion f = Completion(), std::size_t group_size = 4,
+		std::size_t fan_in = 4, std::vector<int> node_of = numa_node_of_cpu())
+		: node_of_cpu(std::move(node_of)), taken(new std::atomic<bool>[expected]), participants(expected),
+		completion(std::move(f)), id(next_id()) {
+		if (expected == 0 || group_size == 0 || fan_in < 2)
+			throw std::invalid_argument("tree_barrier: bad shape");
+		slot_node.resize(participants, 0);
+		for (std::size_t i = 0; i < participants; ++i) {
+			taken[i].store(false, std::memory_order_relaxed);
+			if (i < node_of_cpu.size())
+				slot_node[i] = node_of_cpu[i];
+		}
+		build(group_size, fan_in);
+	}
+	tree_barrier(tree_barrier const&) = delete;
+	tree_barrier& operator=(tree_barrier const&) = delete;
+
+	[[nodiscard]] arrival_token arrive(std::size_t participant) { return arrive_at(participant, false); }
+	[[nodiscard]] arrival_token arrive() { return arrive(my_slot()); }
+
+	// Spin a little ( the others are usually almost there ), then sleep on the phase word//
+	void wait(arrival_token token) const {
+		for (int spins = 0; spins < 256; ++spins) {
+			if (phase.load(std::memory_order_acquire) != token)
+				return;
+			cpu_relax();
+		}
+		while (phase.load(std::memory_order_acquire) == token) {
+			phase.wait(token, std::memory_order_acquire);
+		}
+	}
+
+	void arrive_and_wait(std::size_t participant) { wait(arrive(participant)); }
+	void arrive_and_wait() { wait(arrive()); }
+
+	// Arrive for this phase, and don't count me in for the next ones//
+	void arrive_and_drop(std::size_t participant) { (void)arrive_at(participant, true); }
+	void arrive_and_drop() { arrive_and_drop(my_slot()); }
+
+	std::size_t counters() const { return node_count; }
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+constexpr int phases = 20000;
+
+// Phases per second, every thread arrive_and_wait()s phases times. Thread t is pinned to the t-th allowed CPU//
+template <typename Barrier>
+double phase_rate(Barrier& barrier, int threads) {
+	std::vector<unsigned> const cpus = allowed_cpus();
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> thread_vec{};
+	for (int t = 0; t < threads; ++t) {
+		unsigned const cpu = cpus[static_cast<std::size_t>(t) % cpus.size()];
+		thread_vec.push_back(std::thread([&barrier, cpu]() {
+			pin_this_thread(cpu);
+			for (int i = 0; i < phases; ++i) {
+				barrier.arrive_and_wait();
+			}
+		}));
+	}
+	for (std::thread& t : thread_vec) {
+		t.join();
+	}
+	std::chrono::duration<double> const s = std::chrono::steady_clock::now() - start;
+	return phases / s.count();
+}
+
+int main() {
+	// Note 6 BLK6, with the tree barrier//
+	{
+		tree_barrier my_barr(2, []() noexcept {puts("Green Light is on. Go ahead!"); });
+		std::thread t1(
+			[&]() {
+				std::cout << "t1 is setting up\n";
+				my_barr.arrive_and_wait();
+				std::cout << "Barrier down, t1 is running\n";
+			});
+		std::cout << "main is setting up\n";
+		my_barr.arrive_and_wait();
+		std::cout << "Barrier down, t2 is running \n";
+		t1.join();
+	}
+
+	// arrive_and_drop: 4 workers, worker i leaves after i + 1 phases, the others keep going//
+	{
+		std::atomic<int> completions{ 0 };
+		auto count = [&completions]() noexcept {completions++; };
+		tree_barrier<decltype(count)> barr(4, count, 2, 2);
+		std::vector<std::thread> thread_vec{};
+		for (std::size_t w = 0; w < 4; ++w) {
+			thread_vec.push_back(std::thread([&barr, w]() {
+				for (std::size_t p = 0; p < w; ++p) {
+					barr.arrive_and_wait(w);
+				}
+				barr.arrive_and_drop(w);
+			}));
+		}
+		for (std::thread& t : thread_vec) {
+			t.join();
+		}
+		std::cout << "phases completed with drops: " << completions << " ( expected 4 )\n";
+	}
+
+	unsigned const cores = std::max(2u, static_cast<unsigned>(allowed_cpus().size()));
+	std::vector<int> thread_counts;
+	for (unsigned n = 2; n < cores; n *= 2) {
+		thread_counts.push_back(static_cast<int>(n));
+	}
+	thread_counts.push_back(static_cast<int>(cores));
+
+	std::vector<int> const node_of = numa_node_of_cpu();
+	int const numa_nodes = node_of.empty() ? 1 : *std::max_element(node_of.begin(), node_of.end()) + 1;
+	std::cout << "phases per second ( " << allowed_cpus().size() << " cores allowed, "
+		<< numa_nodes << " NUMA nodes, threads pinned )\n";
+	std::cout << std::setw(8) << "threads" << std::setw(16) << "std::barrier" << std::setw(16) << "tree_barrier"
+		<< std::setw(10) << "counters" << "\n";
+	for (int threads : thread_counts) {
+		std::barrier<> flat(threads);
+		tree_barrier<> tree(threads);
+		std::cout << std::setw(8) << threads << std::fixed << std::setprecision(0)
+			<< std::setw(16) << phase_rate(flat, threads) << std::setw(16) << phase_rate(tree, threads)
+			<< std::setw(10) << tree.counters() << std::endl;
+	}
+}
+
+#endif // BLK2
@@ -0,0 +1,338 @@
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <mutex>
+#include <latch>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+/*
+	6.Sharing_data_between_threads.cpp BLK6 says "Latch is good for resolving the thread starting problem".
+	And then nobody used it. Meanwhile:
+		4.Data_Race_Mutex.cpp    => for (size_t i = 0; i < 4; i++) thread_vec.push_back(std::thread(funcA));
+		6 BLK4 ( accum )         => first, half, last, two packaged_tasks, two threads
+	Hard coded 2 or 4, brand new threads every time, and the splitting written by hand.
+
+	parallel_for(first, last, grain, body) does the fork-join in one call:
+		fork => a start gate opens, the persistent workers ( created ONCE ) all wake up on the same job
+		work => everybody, the calling thread too, runs pieces of [first, last) through body
+		join => a std::latch counts the workers down, the caller waits for zero
+	( the start gate is a latch that can be reused: a generation number that only goes up )
+
+	Who runs which piece, the schedule:
+		static_split => range cut in equal blocks, one per thread. No shared counter at all, best when every
+		                element costs the same.
+		dynamic      => a shared counter, grab grain elements, come back for more. Uneven work balances itself,
+		                but every grab is an atomic on the same cache line.
+		guided       => like dynamic, but the grabs start big ( remaining / 2 threads ) and shrink down to grain.
+		                Few grabs at the start, fine balancing at the end.
+	( OpenMP's schedule(static), schedule(dynamic), schedule(guided) )
+
+	body is either body(i) for every index, or body(lo, hi) for a whole piece ( a tight loop the compiler can vectorize ).
+	An exception in body stops handing out pieces, and is rethrown from parallel_for.
+*/
+
+// fork_join_team and parallel_for //
+#define BLK1
+
+// funcA from note 4 and accum from note 6 BLK4 as a single call, fresh threads vs the team, and the schedules ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+enum class schedule { static_split, dynamic, guided };
+
+class fork_join_team {
+	struct job {
+		std::size_t first;
+		std::size_t last;
+		std::size_t grain;
+		schedule kind;
+		std::size_t threads;
+		// The body, type-erased. No std::function => no allocation per call//
+		void const* body;
+		void (*run)(void const*, std::size_t, std::size_t);
+		alignas(64) std::atomic<std::size_t> next;
+		std::atomic<bool> failed{ false };
+		std::exception_ptr error;
+		std::latch done;
+
+		job(std::size_t f, std::size_t l, std::size_t g, schedule k, std::size_t t, void const* b,
+			void (*r)(void const*, std::size_t, std::size_t))
+			: first(f), last(l), grain(g), kind(k), threads(t), body(b), run(r), next(f), done(static_cast<std::ptrdiff_t>(t - 1)) {}
+	};
+
+	std::vector<std::thread> workers;
+	// Start gate: bumped once per parallel_for, workers sleep on it//
+	alignas(64) std::atomic<std::uint64_t> generation{ 0 };
+	job* current = nullptr;
+	bool stopping = false;
+	// One fork-join at a time per team//
+	std::mutex call;
+
+	// true while this thread runs a body: a worker always, the caller during its own share//
+	static bool& inside_body() {
+		thread_local bool flag = false;
+		return flag;
+	}
+
+	// Sets the flag for a scope, and puts the old value back even when the scope is left by an exception//
+	struct body_scope {
+		bool const was = std::exchange(inside_body(), true);
+		~body_scope() { inside_body() = was; }
+	};
+
+	static void fail(job& j) {
+		// First exception wins, the others are dropped//
+		if (!j.failed.exchange(true, std::memory_order_acq_rel))
+			j.error = std::current_exception();
+		j.next.store(j.last, std::memory_order_relaxed);
+	}
+
+	// Everything one thread ( number me of j.threads ) does for a job//
+	static void share(job& j, std::size_t me) {
+		try {
+			if (j.kind == schedule::static_split) {
+				std::size_t const n = j.last - j.first;
+				std::size_t lo = j.first + n * me / j.threads;
+				std::size_t const hi = j.first + n * (me + 1) / j.threads;
+				while (lo < hi && !j.failed.load(std::memory_order_relaxed)) {
+					std::size_t const end = std::min(hi, lo + j.grain);
+					j.run(j.body, lo, end);
+					lo = end;
+				}
+			}
+			else if (j.kind == schedule::dynamic) {
+				for (;;) {
+					std::size_t const lo = j.next.fetch_add(j.grain, std::memory_order_relaxed);
+					if (lo >= j.last)
+						break;
+					j.run(j.body, lo, std::min(j.last, lo + j.grain));
+				}
+			}
+			else {
+				std::size_t lo = j.next.load(std::memory_order_relaxed);
+				while (lo < j.last) {
+					std::size_t const size = std::min(j.last - lo, std::max(j.grain, (j.last - lo) / (2 * j.threads)));
+					if (j.next.compare_exchange_weak(lo, lo + size, std::memory_order_relaxed)) {
+						j.run(j.body, lo, lo + size);
+						lo = j.next.load(std::memory_order_relaxed);
+					}
+				}
+			}
+		}
+		catch (...) {
+			fail(j);
+		}
+	}
+
+	void worker_loop(std::size_t me) {
+		inside_body() = true;
+		std::uint64_t seen = 0;
+		for (;;) {
+			// Back to back parallel_for calls are the common case: spin a little before sleeping//
+			for (int spins = 0; spins < 128 && generation.load(std::memory_order_acquire) == seen; ++spins) {
+				cpu_relax();
+			}
+			generation.wait(seen, std::memory_order_acquire);
+			seen = generation.load(std::memory_order_acquire);
+			if (stopping)
+				return;
+			job& j = *current;
+			share(j, me);
+			j.done.count_down();
+		}
+	}
+
+	template <typename Body>
+	static void run_piece(void const* b, std::size_t lo, std::size_t hi) {
+		Body const& body = *static_cast<Body const*>(b);
+		if constexpr (std::is_invocable_v<Body const&, std::size_t, std::size_t>) {
+			body(lo, hi);
+		}
+		else {
+			for (std::size_t i = lo; i < hi; ++i) {
+				body(i);
+			}
+		}
+	}
+
+public:
+	// threads counts the caller: threads - 1 workers are created//
+	explicit fork_join_team(std::size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+		for (std::size_t w = 1; w < std::max<std::size_t>(threads, 1); ++w) {
+			workers.push_back(std::thread(&fork_join_team::worker_loop, this, w));
+		}
+	}
+	~fork_join_team() {
+		{
+			std::lock_guard guard(call);
+			stopping = true;
+			generation.fetch_add(1, std::memory_order_release);
+		}
+		generation.notify_all();
+		for (std::thread& t : workers) {
+			t.join();
+		}
+	}
+	fork_join_team(fork_join_team const&) = delete;
+	fork_join_team& operator=(fork_join_team const&) = delete;
+
+	std::size_t size() const { return workers.size() + 1; }
+
+	template <typename Body>
+	void parallel_for(std::size_t first, std::size_t last, std::size_t grain, Body const& body,
+		schedule kind = schedule::static_split) {
+		if (first >= last)
+			return;
+		grain = std::max<std::size_t>(grain, 1);
+		// One piece of work, or a parallel_for inside a body: no fork, just run it here//
+		if (workers.empty() || last - first <= grain || inside_body()) {
+			run_piece<Body>(&body, first, last);
+			return;
+		}
+		std::lock_guard guard(call);
+		job j(first, last, grain, kind, size(), &body, &fork_join_team::run_piece<Body>);
+		current = &j;
+		generation.fetch_add(1, std::memory_order_release);
+		generation.notify_all();
+		{
+			body_scope scope;
+			share(j, 0);
+		}
+		j.done.wait();
+		if (j.error)
+			std::rethrow_exception(j.error);
+	}
+};
+
+// The team every parallel_for call shares, created on first use//
+inline fork_join_team& default_team() {
+	static fork_join_team team;
+	return team;
+}
+
+template <typename Body>
+void parallel_for(std::size_t first, std::size_t last, std::size_t grain, Body const& body,
+	schedule kind = schedule::static_split) {
+	default_team().parallel_for(first, last, grain, body, kind);
+}
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+// Note 4 BLK2//
+int x = 0;
+std::mutex mu;
+
+// Note 6 BLK4//
+double accum(double* beg, double* end, double init) {
+	return  std::accumulate(beg, end, init);
+}
+
+// Microseconds per call, average over calls//
+template <typename F>
+double us_per_call(int calls, F f) {
+	auto start = std::chrono::steady_clock::now();
+	for (int c = 0; c < calls; ++c) {
+		f();
+	}
+	std::chrono::duration<double, std::micro> const us = std::chrono::steady_clock::now() - start;
+	return us.count() / calls;
+}
+
+int main() {
+	fork_join_team& team = default_team();
+	std::cout << "team of " << team.size() << " threads ( caller included )\n";
+
+	// funcA x 4 threads => 40000 increments, any number of threads//
+	parallel_for(0, 40000, 10000, [](std::size_t lo, std::size_t hi) {
+		std::lock_guard guard1(mu);
+		for (std::size_t i = lo; i < hi; ++i) {
+			x++;
+		}
+	});
+	std::cout << "What is the value of x now: " << x << std::endl;
+
+	// accum: no first / half / last any more//
+	std::vector<double> vec(10000000, 0.5);
+	std::atomic<double> result{ 0.0 };
+	parallel_for(0, vec.size(), 1 << 16, [&](std::size_t lo, std::size_t hi) {
+		result += accum(vec.data() + lo, vec.data() + hi, 0.0);
+	});
+	std::cout << "The value of result is: " << result << std::endl;
+
+	// An exception in one piece comes out of parallel_for//
+	try {
+		parallel_for(0, 1000, 10, [](std::size_t i) {
+			if (i == 500)
+				throw std::runtime_error("Surprise!!!!!!");
+		}, schedule::dynamic);
+	}
+	catch (std::exception const& ex) {
+		std::cout << "parallel_for threw: " << ex.what() << "\n";
+	}
+
+	// Fork-join cost: a small accum, many times. Fresh threads per call ( note 6 BLK4 style ) vs the team//
+	std::vector<double> small(1 << 16, 0.5);
+	std::size_t const threads = team.size();
+	double const fresh = us_per_call(500, [&]() {
+		std::vector<double> partial(threads);
+		std::vector<std::thread> thread_vec{};
+		for (std::size_t t = 0; t < threads; ++t) {
+			thread_vec.push_back(std::thread([&, t]() {
+				double* first = small.data() + small.size() * t / threads;
+				double* last = small.data() + small.size() * (t + 1) / threads;
+				partial[t] = accum(first, last, 0.0);
+			}));
+		}
+		for (std::thread& t : thread_vec) {
+			t.join();
+		}
+	});
+	double const pooled = us_per_call(500, [&]() {
+		std::atomic<double> sum{ 0.0 };
+		parallel_for(0, small.size(), 4096, [&](std::size_t lo, std::size_t hi) {
+			sum += accum(small.data() + lo, small.data() + hi, 0.0);
+		});
+	});
+	std::cout << std::fixed << std::setprecision(1)
+		<< "accum over 64K doubles, us per call: fresh threads " << fresh << ", parallel_for " << pooled << "\n";
+
+	// Uneven work: element i costs i. Static gives the last thread the most expensive block//
+	auto uneven = [](std::size_t i) {
+		double volatile sink = 0;
+		for (std::size_t k = 0; k < i; ++k) {
+			sink = sink + std::sqrt(static_cast<double>(k));
+		}
+	};
+	std::cout << "uneven loop ( 4000 elements, element i costs i ), ms per call:\n";
+	for (auto [kind, name] : { std::pair{ schedule::static_split, "static_split" }, std::pair{ schedule::dynamic, "dynamic" },
+		std::pair{ schedule::guided, "guided" } }) {
+		double const ms = us_per_call(5, [&]() { parallel_for(0, 4000, 16, uneven, kind); }) / 1000.0;
+		std::cout << std::setw(14) << name << std::setw(10) << std::setprecision(2) << ms << "\n";
+	}
+}
+
+#endif // BLK2
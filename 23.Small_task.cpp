@@ -0,0 +1,553 @@
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <array>
+#include <vector>
+#include <numeric>
+#include <new>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+/*
+	Count the mallocs in the accum demo of 6.Sharing_data_between_threads.cpp BLK4:
+		std::packaged_task<double(double*, double*, double)> pt1(accum);
+			=> 1 malloc: the shared state ( result + exception + the type-erased callable, in one block )
+		std::thread t1(std::move(pt1), first, half, 0.0);
+			=> 1 malloc: the copies of ( pt1, first, half, 0.0 ) the new thread reads ( "2.Launching _threads.cpp": the
+			   arguments are copied into the internal storage )
+		And a pool that keeps tasks in a std::function<void()> adds more: std::function has to be copyable, a
+		packaged_task isn't, so people wrap it in a std::shared_ptr => control block + the std::function's own heap copy.
+	Every task => a few trips into malloc, and free often happens on a DIFFERENT thread than the malloc.
+	With lots of tiny tasks, threads queue up inside the allocator. ( Everybody going to the same counter for a paper bag )
+
+	This note:
+		small_task<R(Args...)>  => move-only std::function. A small callable lives INSIDE the object ( small buffer ),
+		                           only a big one goes to the heap. Move-only => a packaged task fits without shared_ptr.
+		light_promise / light_future => the shared state comes from a block pool, not from new: every thread keeps a
+		                           small free list of its own, and swaps batches with a global list when it runs dry / full.
+		small_packaged_task     => the two glued together, the packaged_task replacement.
+	Steady state: zero mallocs per task. ( counted for real in BLK2, by replacing operator new )
+	One catch: a small_packaged_task carries a small_task of its own, so it never fits the DEFAULT 48 bytes of another
+	small_task. The queue has to ask for a buffer that big: small_task<void(), sizeof(small_packaged_task<...>)>.
+*/
+
+// small_task, block_pool, light_promise / light_future, small_packaged_task //
+#define BLK1
+
+// Mallocs per task: packaged_task + std::thread, packaged_task in a std::function queue, small_packaged_task ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+template <typename Signature, std::size_t Capacity = 48>
+class small_task;
+
+template <typename R, typename... Args, std::size_t Capacity>
+class small_task<R(Args...), Capacity> {
+	struct ops {
+		R(*invoke)(void*, Args&&...);
+		void (*move)(void* from, void* to) noexcept;
+		void (*destroy)(void*) noexcept;
+	};
+
+	template <typename F>
+	static constexpr bool fits = sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) &&
+		std::is_nothrow_move_constructible_v<F>;
+
+	// F sits in the buffer//
+	template <typename F>
+	static constexpr ops inline_ops{
+		[](void* p, Args&&... args) -> R { return (*static_cast<F*>(p))(std::forward<Args>(args)...); },
+		[](void* from, void* to) noexcept { ::new (to) F(std::move(*static_cast<F*>(from))); static_cast<F*>(from)->~F(); },
+		[](void* p) noexcept { static_cast<F*>(p)->~F(); }
+	};
+	// Too big: the buffer holds a pointer to F//
+	template <typename F>
+	static constexpr ops heap_ops{
+		[](void* p, Args&&... args) -> R { return (**static_cast<F**>(p))(std::forward<Args>(args)...); },
+		[](void* from, void* to) noexcept { *static_cast<F**>(to) = *static_cast<F**>(from); },
+		[](void* p) noexcept { delete *static_cast<F**>(p); }
+	};
+
+	alignas(std::max_align_t) unsigned char buffer[Capacity];
+	ops const* vt = nullptr;
+
+	static_assert(Capacity >= sizeof(void*), "the buffer must at least hold a pointer");
+
+public:
+	small_task() noexcept = default;
+
+	template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, small_task>>>
+	small_task(F&& f) {
+		using T = std::decay_t<F>;
+		if constexpr (fits<T>) {
+			::new (static_cast<void*>(buffer)) T(std::forward<F>(f));
+			vt = &inline_ops<T>;
+		}
+		else {
+			*reinterpret_cast<T**>(buffer) = new T(std::forward<F>(f));
+			vt = &heap_ops<T>;
+		}
+	}
+	small_task(small_task&& other) noexcept : vt(other.vt) {
+		if (vt) {
+			vt->move(other.buffer, buffer);
+			other.vt = nullptr;
+		}
+	}
+	small_task& operator=(small_task&& other) noexcept {
+		if (this != &other) {
+			reset();
+			if (other.vt) {
+				other.vt->move(other.buffer, buffer);
+				vt = std::exchange(other.vt, nullptr);
+			}
+		}
+		return *this;
+	}
+	small_task(small_task const&) = delete;
+	small_task& operator=(small_task const&) = delete;
+	~small_task() { reset(); }
+
+	void reset() noexcept {
+		if (vt) {
+			vt->destroy(buffer);
+			vt = nullptr;
+		}
+	}
+
+	R operator()(Args... args) { return vt->invoke(buffer, std::forward<Args>(args)...); }
+	explicit operator bool() const noexcept { return vt != nullptr; }
+
+	// Will F be stored without a malloc?//
+	template <typename F>
+	static constexpr bool stored_inline() { return fits<std::decay_t<F>>; }
+};
+
+/*
+	Fixed size blocks, recycled forever.
+	Every thread has a cache of up to 2 * batch free blocks: allocate and free are a pointer push / pop, no lock.
+	A thread that only frees ( the consumer ) fills up and hands a batch to the global list,
+	a thread that only allocates ( the producer ) runs dry and takes a batch from it. One lock per batch, not per block.
+	Only when the global list is empty too, a new block comes from operator new.
+*/
+template <std::size_t Size, std::size_t Align>
+class block_pool {
+	static constexpr std::size_t batch = 32;
+
+	struct free_block {
+		free_block* next;
+	};
+	static constexpr std::size_t block_size = Size < sizeof(free_block) ? sizeof(free_block) : Size;
+
+	struct global_list {
+		std::mutex m;
+		free_block* head = nullptr;
+		~global_list() {
+			while (head) {
+				::operator delete(std::exchange(head, head->next), std::align_val_t(Align));
+			}
+		}
+	};
+	static global_list& global() {
+		static global_list list;
+		return list;
+	}
+
+	struct cache {
+		free_block* head = nullptr;
+		std::size_t count = 0;
+		~cache() {
+			// The thread is going away, its blocks go back for the others//
+			while (count > 0) {
+				give_back();
+			}
+		}
+		void give_back() {
+			global_list& g = global();
+			std::lock_guard guard(g.m);
+			for (std::size_t i = 0; i < batch && head; ++i, --count) {
+				free_block* const b = std::exchange(head, head->next);
+				b->next = g.head;
+				g.head = b;
+			}
+		}
+		void take() {
+			global_list& g = global();
+			std::lock_guard guard(g.m);
+			for (std::size_t i = 0; i < batch && g.head; ++i, ++count) {
+				free_block* const b = std::exchange(g.head, g.head->next);
+				b->next = head;
+				head = b;
+			}
+		}
+	};
+	static cache& local() {
+		thread_local cache c;
+		return c;
+	}
+
+public:
+	static void* allocate() {
+		cache& c = local();
+		if (!c.head)
+			c.take();
+		if (!c.head)
+			return ::operator new(block_size, std::align_val_t(Align));
+		--c.count;
+		return std::exchange(c.head, c.head->next);
+	}
+	static void deallocate(void* p) noexcept {
+		cache& c = local();
+		c.head = ::new (p) free_block{ c.head };
+		if (++c.count > 2 * batch)
+			c.give_back();
+	}
+};
+
+namespace light_detail {
+	struct nothing {};
+
+	enum : std::uint32_t { pending, has_value, has_error };
+
+	// Promise and future share it, the last one out returns it to the pool//
+	template <typename T>
+	struct state {
+		using stored = std::conditional_t<std::is_void_v<T>, nothing, T>;
+
+		std::atomic<std::uint32_t> ready{ pending };
+		std::atomic<int> refs{ 2 };
+		std::exception_ptr error;
+		alignas(stored) unsigned char value[sizeof(stored)];
+
+		// state is complete inside the bodies, so the pool can be sized to it//
+		static void* operator new(std::size_t) { return block_pool<sizeof(state), alignof(state)>::allocate(); }
+		static void operator delete(void* p) noexcept { block_pool<sizeof(state), alignof(state)>::deallocate(p); }
+
+		~state() {
+			if (ready.load(std::memory_order_relaxed) == has_value)
+				reinterpret_cast<stored*>(value)->~stored();
+		}
+		void release() {
+			if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete this;
+		}
+		void publish(std::uint32_t what) {
+			ready.store(what, std::memory_order_release);
+			ready.notify_all();
+		}
+	};
+}
+
+template <typename T>
+class light_future {
+	template <typename> friend class light_promise;
+	light_detail::state<T>* s = nullptr;
+	explicit light_future(light_detail::state<T>* st) : s(st) {}
+public:
+	light_future() = default;
+	light_future(light_future&& other) noexcept : s(std::exchange(other.s, nullptr)) {}
+	light_future& operator=(light_future&& other) noexcept {
+		if (this != &other) {
+			if (s)
+				s->release();
+			s = std::exchange(other.s, nullptr);
+		}
+		return *this;
+	}
+	~light_future() {
+		if (s)
+			s->release();
+	}
+
+	bool valid() const { return s != nullptr; }
+	bool is_ready() const { return s->ready.load(std::memory_order_acquire) != light_detail::pending; }
+	void wait() const {
+		s->ready.wait(light_detail::pending, std::memory_order_acquire);
+	}
+	// Like std::future::get(): once only, the future is empty afterwards//
+	T get() {
+		wait();
+		std::unique_ptr<light_detail::state<T>, void (*)(light_detail::state<T>*)> done(std::exchange(s, nullptr),
+			[](light_detail::state<T>* st) {st->release(); });
+		if (done->ready.load(std::memory_order_relaxed) == light_detail::has_error)
+			std::rethrow_exception(done->error);
+		if constexpr (!std::is_void_v<T>)
+			return std::move(*reinterpret_cast<T*>(done->value));
+	}
+};
+
+template <typename T>
+class light_promise {
+	light_detail::state<T>* s;
+	bool future_taken = false;
+
+	// Nobody will set a value any more: wake the future with broken_promise, drop our references//
+	void abandon() {
+		if (!s)
+			return;
+		if (s->ready.load(std::memory_order_relaxed) == light_detail::pending) {
+			s->error = std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+			s->publish(light_detail::has_error);
+		}
+		// Nobody asked for the future: its reference goes too//
+		if (!future_taken)
+			s->release();
+		std::exchange(s, nullptr)->release();
+	}
+public:
+	light_promise() : s(new light_detail::state<T>) {}
+	light_promise(light_promise&& other) noexcept
+		: s(std::exchange(other.s, nullptr)), future_taken(other.future_taken) {}
+	light_promise& operator=(light_promise&& other) noexcept {
+		if (this != &other) {
+			abandon();
+			s = std::exchange(other.s, nullptr);
+			future_taken = other.future_taken;
+		}
+		return *this;
+	}
+	~light_promise() { abandon(); }
+
+	light_future<T> get_future() {
+		if (future_taken)
+			throw std::future_error(std::future_errc::future_already_retrieved);
+		future_taken = true;
+		return light_future<T>(s);
+	}
+
+	template <typename... V>
+	void set_value(V&&... v) {
+		if (s->ready.load(std::memory_order_relaxed) != light_detail::pending)
+			throw std::future_error(std::future_errc::promise_already_satisfied);
+		::new (static_cast<void*>(s->value)) typename light_detail::state<T>::stored(std::forward<V>(v)...);
+		s->publish(light_detail::has_value);
+	}
+	void set_exception(std::exception_ptr e) {
+		if (s->ready.load(std::memory_order_relaxed) != light_detail::pending)
+			throw std::future_error(std::future_errc::promise_already_satisfied);
+		s->error = std::move(e);
+		s->publish(light_detail::has_error);
+	}
+};
+
+template <typename Signature, std::size_t Capacity = 48>
+class small_packaged_task;
+
+template <typename R, typename... Args, std::size_t Capacity>
+class small_packaged_task<R(Args...), Capacity> {
+	small_task<R(Args...), Capacity> fn;
+	light_promise<R> promise;
+public:
+	template <typename F>
+	explicit small_packaged_task(F&& f) : fn(std::forward<F>(f)) {}
+	small_packaged_task(small_packaged_task&&) noexcept = default;
+	small_packaged_task& operator=(small_packaged_task&&) noexcept = default;
+
+	light_future<R> get_future() { return promise.get_future(); }
+
+	void operator()(Args... args) {
+		try {
+			if constexpr (std::is_void_v<R>) {
+				fn(std::forward<Args>(args)...);
+				promise.set_value();
+			}
+			else {
+				promise.set_value(fn(std::forward<Args>(args)...));
+			}
+		}
+		catch (...) {
+			promise.set_exception(std::current_exception());
+		}
+	}
+};
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+// Every operator new in the program goes through here, so we can count them//
+std::atomic<std::size_t> mallocs{ 0 };
+
+void* operator new(std::size_t size) {
+	mallocs.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void* operator new(std::size_t size, std::align_val_t align) {
+	mallocs.fetch_add(1, std::memory_order_relaxed);
+	std::size_t const a = static_cast<std::size_t>(align);
+	if (void* p = std::aligned_alloc(a, (size + a - 1) / a * a))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+// Note 6 BLK4//
+double accum(double* beg, double* end, double init) {
+	return  std::accumulate(beg, end, init);
+}
+
+// One worker thread fed through a fixed ring: the queue itself never allocates//
+template <typename Task, std::size_t N = 256>
+class task_ring {
+	std::array<Task, N> slots;
+	std::size_t head = 0, tail = 0;
+	bool closed = false;
+	std::mutex m;
+	std::condition_variable not_empty, not_full;
+	std::thread worker;
+public:
+	task_ring() : worker([this]() {
+		for (;;) {
+			Task t;
+			{
+				std::unique_lock lk(m);
+				not_empty.wait(lk, [this]() {return head != tail || closed; });
+				if (head == tail)
+					return;
+				t = std::move(slots[head++ % N]);
+			}
+			not_full.notify_one();
+			t();
+		}
+	}) {}
+	~task_ring() {
+		{
+			std::lock_guard lk(m);
+			closed = true;
+		}
+		not_empty.notify_one();
+		worker.join();
+	}
+	void push(Task t) {
+		{
+			std::unique_lock lk(m);
+			not_full.wait(lk, [this]() {return tail - head < N; });
+			slots[tail++ % N] = std::move(t);
+		}
+		not_empty.notify_one();
+	}
+};
+
+constexpr std::size_t window = 128;
+
+struct result {
+	double mallocs_per_task;
+	double us_per_task;
+};
+
+// Submit tasks in windows of 128, get() them all, repeat. Warm up first, then count//
+template <typename Submit>
+result measure(std::size_t tasks, Submit submit) {
+	submit(window * 4);
+	std::size_t const before = mallocs.load();
+	auto start = std::chrono::steady_clock::now();
+	submit(tasks);
+	std::chrono::duration<double, std::micro> const us = std::chrono::steady_clock::now() - start;
+	return { static_cast<double>(mallocs.load() - before) / tasks, us.count() / tasks };
+}
+
+int main() {
+	std::vector<double> vec(1024, 0.5);
+	double* const first = vec.data();
+	double* const last = first + vec.size();
+
+	std::cout << "sizeof(small_task<void()>) = " << sizeof(small_task<void()>) << ", accum lambda stored inline: "
+		<< std::boolalpha << small_task<double()>::stored_inline<decltype([first, last]() {return accum(first, last, 0.0); })>()
+		<< "\n";
+	std::cout << "sizeof(small_packaged_task<double()>) = " << sizeof(small_packaged_task<double()>)
+		<< ", stored inline in small_task<void()>: " << small_task<void()>::stored_inline<small_packaged_task<double()>>()
+		<< ", in small_task<void(), " << sizeof(small_packaged_task<double()>) << ">: "
+		<< small_task<void(), sizeof(small_packaged_task<double()>)>::stored_inline<small_packaged_task<double()>>() << "\n";
+
+	// 1. Note 6 BLK4: a packaged_task and a std::thread per task//
+	result const threads = measure(2000, [&](std::size_t n) {
+		for (std::size_t i = 0; i < n; ++i) {
+			std::packaged_task<double(double*, double*, double)> pt(accum);
+			auto f = pt.get_future();
+			std::thread t(std::move(pt), first, last, 0.0);
+			f.get();
+			t.join();
+		}
+	});
+
+	// 2. Persistent worker, tasks in std::function<void()>: the packaged_task must ride in a shared_ptr//
+	result pooled_std;
+	{
+		task_ring<std::function<void()>> ring;
+		pooled_std = measure(200000, [&](std::size_t n) {
+			std::array<std::future<double>, window> fs;
+			for (std::size_t done = 0; done < n; done += window) {
+				for (auto& f : fs) {
+					auto pt = std::make_shared<std::packaged_task<double()>>([first, last]() {return accum(first, last, 0.0); });
+					f = pt->get_future();
+					ring.push([pt]() {(*pt)(); });
+				}
+				for (auto& f : fs) {
+					f.get();
+				}
+			}
+		});
+	}
+
+	// 3. Persistent worker, small_packaged_task moved straight into a small_task<void()>//
+	// The ring's small_task is widened on purpose: a small_packaged_task ( 80 bytes on x86-64 ) doesn't fit the//
+	// default 48 bytes, it would go to the heap, one malloc per task again//
+	result pooled_small;
+	{
+		task_ring<small_task<void(), sizeof(small_packaged_task<double()>)>> ring;
+		pooled_small = measure(200000, [&](std::size_t n) {
+			std::array<light_future<double>, window> fs;
+			for (std::size_t done = 0; done < n; done += window) {
+				for (auto& f : fs) {
+					small_packaged_task<double()> pt([first, last]() {return accum(first, last, 0.0); });
+					f = pt.get_future();
+					ring.push(std::move(pt));
+				}
+				for (auto& f : fs) {
+					f.get();
+				}
+			}
+		});
+	}
+
+	std::cout << std::setw(44) << "" << std::setw(16) << "mallocs/task" << std::setw(12) << "us/task" << "\n";
+	auto row = [](char const* name, result r) {
+		std::cout << std::setw(44) << std::left << name << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(16) << r.mallocs_per_task << std::setw(12) << r.us_per_task << "\n";
+	};
+	row("packaged_task + std::thread ( note 6 BLK4 )", threads);
+	row("shared_ptr<packaged_task> in std::function", pooled_std);
+	row("small_packaged_task in small_task", pooled_small);
+
+	// A broken promise still reports like std::future does//
+	light_future<int> orphan;
+	{
+		light_promise<int> p;
+		orphan = p.get_future();
+	}
+	try {
+		orphan.get();
+	}
+	catch (std::future_error const& e) {
+		std::cout << "promise dropped without a value: " << e.what() << "\n";
+	}
+}
+
+#endif // BLK2
@@ -163,4 +163,6 @@ public:
 
 	I really hope I will something more to add, and gradually make this become to my ref book in the future 
 
+	( 14.Thread_group.cpp builds a whole group of these, with stop_token cancellation and core pinning )
+
 */
\ No newline at end of file
@@ -129,6 +129,7 @@ int main() {
 using namespace std;
 int x = 0;
 
+// ( 16.Lock_contention_profiler.cpp measures how long threads wait for mu and how long they hold it )//
 mutex mu;
 
 void funcA() {
@@ -161,6 +162,7 @@ void funcA() {
 }
 
 int main() {
+	// ( 22.Parallel_for.cpp turns this thread vector into one parallel_for call, on threads that already exist )//
 	std::vector<std::thread> thread_vec{};
 	for (size_t i = 0; i < 4; i++){
 		thread_vec.push_back(std::thread(funcA));
@@ -243,6 +245,7 @@ int main() {
 	// One of the thread launched and trigger the exception from the task
 	// exit from the loop and go to the catch block// 
 	// Then the rest of 3 threads carried on//
+	// ( 14.Thread_group.cpp BLK3 keeps every thread's exception, and stops the other threads early )//
 	cout << "What is the value of x now: " << x << endl;
 }
 #endif // BLK3
\ No newline at end of file
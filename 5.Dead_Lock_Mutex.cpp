@@ -130,6 +130,7 @@ void swap(X& lhs, X& rhs) {
 	// This is like using the lock and transferring the ownership at once // 
 	// So it is exception safe because it follows RAII rules//
 	// Also, c++ 17 makes you save some template argument <std::mutex>
+	// ( Under heavy cross-swapping std::lock keeps backing off, 18.Ordered_multi_lock.cpp locks by address instead )//
 	std::scoped_lock guard(lhs.m, rhs.m);
 	swap(lhs.some_detail, rhs.some_detail);
 }
@@ -161,6 +162,8 @@ void swap(X& lhs, X& rhs) {
 		Acquire locks in a fixed order
 
 		Use a lock hierarchy
+
+	15.Lock_order_detector.cpp checks the last two at runtime ( and reports lock order cycles before they deadlock )
 */
 
 
@@ -253,6 +256,7 @@ void process_data()
 	The granularity of a lock	=>	describes the amount of data protected by a single lock.
 	A fine_grained lock protects a small amount of data
 	A coarse-grained lock protects a large amount of data
+	( 19.Striped_hash_map.cpp is the fine grained version of a whole lookup table )
 
 	Also, lock the right mutex for the right operation is important.
 	Only lock the mutex when you are touching the shared_data.
@@ -269,6 +273,7 @@ void process_data()
 // Once your lock_guard out of function scope, it will be unlocked. 
 // Then the data could be maniped by the other threads. 
 // how can you assure the returned boolean is accurate? 
+// ( get_detail() only reads, 17.Read_mostly_locks.cpp lets the readers in together )//
 class Y{
 private:
 	int some_detail;
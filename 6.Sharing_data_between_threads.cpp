@@ -12,6 +12,18 @@
 #include <chrono>
 #include <latch>
 #include <barrier>
+#include <deque>
+#include <iterator>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <cstdlib>
+#include <utility>
+#include <optional>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
 /*
 	After previous two notes about mutex, we learned how to protect the shared data. However, sometimes, we
 	need to synchronize actions on separate threads.
@@ -33,13 +45,22 @@
 // 2. std::packaged_task<> // 
 //#define BLK4
 // 3. Manually create std::promise and std::future
-#define BLK5
+//#define BLK5
 
 // sync with latches and barrier
 //#define BLK6
 
-#define BLK7
-#define BLK8
+// Batched push/pop for the producer/consumer queue from BLK2 //
+//#define BLK7
+
+// An event built on std::atomic wait/notify, to replace the sleep polling in BLK1 //
+//#define BLK8
+
+// BLK2's pipeline without the copies: per-producer chunk pools, chunks passed by pointer //
+//#define BLK9
+
+// BLK2's queue with a capacity: backpressure or dropping, close() and drain, N consumers woken in order //
+#define BLK10
 
 
 #ifdef BLK1
@@ -91,6 +112,11 @@ void wait_for_flag()
 			The follows code blocks would be covered this topic.
 */
 
+/*
+	BLK8 at the end of this note turns wait_for_flag() into a real event, and measures the wake up latency
+	of all three: this sleep loop, the condition_variable from BLK2, and the event.
+*/
+
 
 
 #endif // BLK1
@@ -118,12 +144,14 @@ bool is_last_chunk(data_chunk& src);
 
 
 std::mutex mut;
+// ( No limit on its size. BLK10 puts a capacity on it, and close() replaces is_last_chunk() )//
 std::queue<data_chunk> data_queue;
 std::condition_variable data_cond;
 void data_preparation_thread()
 {
 	while (more_data_to_prepare())
 	{
+		// ( const => push() copies it, and front() below copies it again. BLK9 passes pooled chunks by pointer )//
 		data_chunk const data = prepare_data();
 		{
 			std::lock_guard<std::mutex> lk(mut);
@@ -140,6 +168,7 @@ void data_preparation_thread()
 		// When it is out of the scope, the mutex unlocked then you notify all. 
 	}
 }
+// ( One OS thread per loop. 20.Coroutine_pipeline.cpp runs 10k of these pipelines as coroutines on a few threads )//
 void data_processing_thread()
 {
 	while (true)
@@ -194,6 +223,11 @@ void data_processing_thread()
 	Also, a busy wait is unwanted in any cases, that's why the condtion_variable is an optimization over a busy wait
 */
 
+/*
+	When there are many producers and consumers, the single mut becomes the bottleneck.
+	8.Lock_free_queue.cpp has a lock-free drop-in for mut + data_queue + data_cond, with a benchmark.
+*/
+
 
 #endif // BLK2
 
@@ -328,6 +362,7 @@ auto f8 = std::async(3
 auto f9 = std::async(baz, std::ref(x));
 // Invoke deferred function //
 f7.wait();
+// ( Each get() / wait() parks a thread. 9.Thread_pool.cpp BLK4 attaches .then() continuations instead )//
 
 #endif // BLK3
 
@@ -347,7 +382,11 @@ f7.wait();
 		The type does not have to match excatly because the implicit cast will happen.
 
 	The Parameter of the constructor => must be anything callable which matches the template argument
+
+	( 9.Thread_pool.cpp builds that thread pool, so a task no longer needs its own std::thread )
+	( Each packaged_task and each std::thread here is a malloc, 23.Small_task.cpp gets a task down to zero )
 */
+// One accumulator => one add per FP-add latency. 10.SIMD_accumulate.cpp has drop-in SIMD kernels with the same signature//
 double accum(double* beg, double* end, double init) {
 	return  std::accumulate(beg, end, init);
 }
@@ -368,6 +407,7 @@ int main() {
 	/*
 	  To adpat your code in the multithread way
 	  First is divide the work before you do anything
+	  ( 22.Parallel_for.cpp divides it for any number of cores: parallel_for(0, vec.size(), grain, body) )
 	*/
 	double* first = &vec[0];
 	double* half = first + vec.size() / 2;
@@ -466,6 +506,7 @@ int main() {
 		Light weighted for a series of event occurs
 
 	Latch is good for resolving the thread starting problem.
+	( 22.Parallel_for.cpp uses one as the join of every parallel_for call )
 	Also, this is not copyable ( just like mutex )
 
 */
@@ -530,6 +571,7 @@ int main() {
 	// std::barrier BarierName (counterNum, anyCallable has no exception) // 
 	// Second argument is actually the completion function //
 	// When the barrier comes down, the function will be executed // 
+	// Every arrival hits one shared counter, fine for 2, slow for 64 ( 21.Tree_barrier.cpp splits it into a tree )//
 	std::barrier my_barr(2, []() noexcept {puts("Green Light is on. Go ahead!"); });
 	std::thread t1(
 		[&]() {
@@ -545,3 +587,983 @@ int main() {
 
 
 #endif // BLK6
+
+
+
+#ifdef BLK7
+/*
+	Back to the producer/consumer from BLK2.
+	For every single data_chunk, the producer locks mut and calls notify_one(), and the consumer locks mut again
+	to take one chunk. When the chunks are small and frequent, the lock + futex traffic costs more than the work.
+
+	Batch mode:
+		push_n()		=> moves a whole bunch of chunks into the queue under ONE lock and ONE notification
+		pop_up_to(n)	=> takes as many as n chunks out under ONE lock
+
+	But batching has a price: latency.
+	A chunk sitting in a half-full batch is not processed by anyone.
+	So both sides get a timeout:
+		batch_writer flushes when the batch is full OR the oldest chunk in it is older than max_delay
+		pop_up_to(n, max_wait) returns what it has once max_wait has passed since it saw the first chunk
+*/
+struct data_chunk {
+	int id = 0;
+	bool last = false;
+};
+
+template <typename T>
+class batch_queue {
+	std::mutex mut;
+	std::deque<T> data_queue;
+	std::condition_variable data_cond;
+public:
+	// Move [first, last) in under one lock, and wake one consumer//
+	template <typename It>
+	void push_n(It first, It last) {
+		if (first == last)
+			return;
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			data_queue.insert(data_queue.end(), std::make_move_iterator(first), std::make_move_iterator(last));
+		}
+		data_cond.notify_one();
+	}
+
+	void push(T value) {
+		push_n(&value, &value + 1);
+	}
+
+	/*
+		Blocks until there is at least one chunk.
+		Then waits at most max_wait for the queue to collect n chunks, and moves out whatever is there ( 1 .. n ).
+		max_wait == 0 means take what is there right away.
+	*/
+	std::size_t pop_up_to(std::vector<T>& out, std::size_t n,
+		std::chrono::microseconds max_wait = std::chrono::microseconds(0)) {
+		std::unique_lock<std::mutex> lk(mut);
+		for (;;) {
+			data_cond.wait(lk, [this] {return !data_queue.empty(); });
+			if (data_queue.size() < n && max_wait.count() > 0) {
+				// Same lambda rule as BLK2, no side effects inside//
+				data_cond.wait_for(lk, max_wait, [this, n] {return data_queue.size() >= n; });
+			}
+			// wait_for gives the lock away: another consumer may have taken everything meanwhile. Then start over//
+			if (!data_queue.empty())
+				break;
+		}
+		std::size_t const count = std::min(n, data_queue.size());
+		auto const end = data_queue.begin() + static_cast<std::ptrdiff_t>(count);
+		out.insert(out.end(), std::make_move_iterator(data_queue.begin()), std::make_move_iterator(end));
+		data_queue.erase(data_queue.begin(), end);
+		bool const leftovers = !data_queue.empty();
+		lk.unlock();
+		// push_n only woke one of us. If we left something behind, pass the baton to the next consumer.//
+		if (leftovers)
+			data_cond.notify_one();
+		return count;
+	}
+};
+
+/*
+	The producer side helper.
+	Collects the chunks locally, and pushes them with push_n when:
+		1. the batch is full
+		2. the first chunk in the batch has waited longer than max_delay
+		3. flush() is called, or the writer dies ( RAII again, just like lock_guard )
+	Rule 2 can't wait for the next add(): a producer that goes quiet would leave its last chunks stranded.
+	So the writer has a small flusher thread that sleeps until the oldest chunk's deadline and flushes for it.
+	That is why the batch needs a mutex. Only the producer and the flusher ever take it, so it is almost never contended.
+*/
+template <typename T>
+class batch_writer {
+	batch_queue<T>& q;
+	std::vector<T> batch;
+	std::size_t const batch_size;
+	std::chrono::steady_clock::duration const max_delay;
+	std::chrono::steady_clock::time_point oldest{};
+	std::mutex m;
+	std::condition_variable timer_cond;
+	bool stopping = false;
+	std::thread flusher;
+
+	void flush_locked() {
+		q.push_n(batch.begin(), batch.end());
+		batch.clear();
+	}
+
+	void flusher_loop() {
+		std::unique_lock<std::mutex> lk(m);
+		while (!stopping) {
+			if (batch.empty()) {
+				timer_cond.wait(lk, [this] {return stopping || !batch.empty(); });
+				continue;
+			}
+			// oldest may have moved on while we slept ( a full batch went out, a new one started ), so look again//
+			auto const deadline = oldest + max_delay;
+			if (std::chrono::steady_clock::now() >= deadline)
+				flush_locked();
+			else
+				timer_cond.wait_until(lk, deadline);
+		}
+	}
+
+public:
+	batch_writer(batch_queue<T>& queue, std::size_t size, std::chrono::steady_clock::duration delay)
+		: q(queue), batch_size(size), max_delay(delay) {
+		batch.reserve(batch_size);
+		flusher = std::thread(&batch_writer::flusher_loop, this);
+	}
+	~batch_writer() {
+		{
+			std::lock_guard<std::mutex> lk(m);
+			stopping = true;
+		}
+		timer_cond.notify_one();
+		flusher.join();
+		flush();
+	}
+	batch_writer(batch_writer const&) = delete;
+	batch_writer& operator=(batch_writer const&) = delete;
+
+	void add(T value) {
+		std::lock_guard<std::mutex> lk(m);
+		bool const first = batch.empty();
+		if (first)
+			oldest = std::chrono::steady_clock::now();
+		batch.push_back(std::move(value));
+		if (batch.size() >= batch_size)
+			flush_locked();
+		else if (first)
+			timer_cond.notify_one();	// a new deadline for the flusher//
+	}
+	void flush() {
+		std::lock_guard<std::mutex> lk(m);
+		flush_locked();
+	}
+};
+
+batch_queue<data_chunk> data_queue;
+constexpr int chunk_count = 1000000;
+
+void data_preparation_thread()
+{
+	batch_writer<data_chunk> writer(data_queue, 64, std::chrono::microseconds(200));
+	for (int i = 0; i < chunk_count; ++i) {
+		data_chunk data;
+		data.id = i;
+		data.last = (i == chunk_count - 1);
+		writer.add(data);
+	}
+	// writer flushes the tail in its destructor//
+}
+
+void data_processing_thread(long long& sum)
+{
+	std::vector<data_chunk> batch;
+	while (true)
+	{
+		batch.clear();
+		data_queue.pop_up_to(batch, 64, std::chrono::microseconds(200));
+		bool done = false;
+		for (data_chunk& data : batch) {
+			sum += data.id;
+			done = done || data.last;
+		}
+		if (done)
+			break;
+	}
+}
+
+int main() {
+	// A producer that adds 3 chunks and goes quiet: the flusher still sends them once max_delay is over//
+	{
+		batch_queue<data_chunk> quiet_queue;
+		batch_writer<data_chunk> writer(quiet_queue, 64, std::chrono::milliseconds(5));
+		auto const added = std::chrono::steady_clock::now();
+		for (int i = 0; i < 3; ++i) {
+			writer.add(data_chunk{ i, false });
+		}
+		std::vector<data_chunk> got;
+		quiet_queue.pop_up_to(got, 64);
+		auto const waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - added);
+		std::cout << "Idle producer: " << got.size() << " chunks arrived after " << waited.count() << " us ( max_delay 5000 us )\n";
+	}
+
+	long long sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	std::thread t1(data_preparation_thread);
+	std::thread t2(data_processing_thread, std::ref(sum));
+	t1.join();
+	t2.join();
+	auto dur = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	std::cout << "Processed " << chunk_count << " chunks in batches, sum = " << sum
+		<< ", it took: " << dur.count() << " milliseconds to complete" << std::endl;
+}
+
+#endif // BLK7
+
+
+
+#ifdef BLK8
+/*
+	wait_for_flag() in BLK1 sleeps 100 ms between checks.
+	So when the flag is set, the waiter notices it somewhere between 0 and 100 ms later, 50 ms on average.
+	That's not a wake up, that's a nap.
+
+	The condition_variable in BLK2 fixes that, but it needs a mutex, a predicate, and the notify goes through
+	the kernel every time.
+
+	C++20 gave std::atomic two new methods:
+		wait(old)		=> block while the value is still old ( on linux this is a futex, on windows WaitOnAddress )
+		notify_one() / notify_all()
+
+	With those, an event is just one 32 bit atomic ( bit 0 => the event is set ), plus a count of the sleepers.
+	A waiter counts itself in before it sleeps and out when it wakes up, so set() only calls notify while
+	somebody is really asleep ( otherwise set() is one atomic instruction and one load )
+
+	Two flavours:
+		one_shot	=> once set, it stays set. Every waiter, now and later, goes through. ( like std::latch(1) )
+		auto_reset	=> set() lets exactly ONE waiter through, and that waiter resets it. ( like a turnstile )
+
+	wait() spins for a little while first: when the setter is only a few hundred nanoseconds away,
+	spinning is way cheaper than going to sleep and getting woken up.
+
+	std::atomic::wait has no timeout. So wait_for() parks on a condition_variable instead, and set() only
+	touches that condition_variable when a timed waiter is actually there.
+*/
+class event {
+public:
+	enum class mode { one_shot, auto_reset };
+
+private:
+	static constexpr std::uint32_t set_bit = 1;
+	static constexpr int spin_limit = 2000;
+
+	std::atomic<std::uint32_t> state{ 0 };
+	// Waiters inside state.wait() ( or about to be )//
+	std::atomic<int> sleepers{ 0 };
+	mode const kind;
+
+	// Only for wait_for()//
+	std::atomic<int> timed_waiters{ 0 };
+	std::mutex timed_mut;
+	std::condition_variable timed_cond;
+
+	// Take the event if it is set. auto_reset waiters have to win the CAS that clears the bit//
+	bool try_take() {
+		std::uint32_t s = state.load(std::memory_order_acquire);
+		while (s & set_bit) {
+			if (kind == mode::one_shot)
+				return true;
+			if (state.compare_exchange_weak(s, s & ~set_bit, std::memory_order_acquire, std::memory_order_acquire))
+				return true;
+		}
+		return false;
+	}
+
+	bool spin() {
+		for (int i = 0; i < spin_limit; ++i) {
+			if (try_take())
+				return true;
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+			_mm_pause();
+#else
+			std::this_thread::yield();
+#endif
+		}
+		return false;
+	}
+
+public:
+	explicit event(mode m = mode::one_shot) : kind(m) {}
+	event(event const&) = delete;
+	event& operator=(event const&) = delete;
+
+	void set() {
+		state.fetch_or(set_bit, std::memory_order_seq_cst);
+		// seq_cst on both sides: either the waiter sees the bit, or we see the waiter//
+		if (sleepers.load(std::memory_order_seq_cst) > 0) {
+			if (kind == mode::one_shot)
+				state.notify_all();
+			else
+				state.notify_one();
+		}
+		if (timed_waiters.load(std::memory_order_seq_cst) > 0) {
+			// Taking the lock means a timed waiter is either before its predicate check or really asleep//
+			std::lock_guard<std::mutex> lk(timed_mut);
+			timed_cond.notify_all();
+		}
+	}
+
+	// Only means something for one_shot, an auto_reset event resets itself//
+	void reset() {
+		state.fetch_and(~set_bit, std::memory_order_relaxed);
+	}
+
+	bool is_set() const {
+		return (state.load(std::memory_order_acquire) & set_bit) != 0;
+	}
+
+	void wait() {
+		if (spin())
+			return;
+		for (;;) {
+			if (try_take())
+				return;
+			// Count in, look once more, sleep only while it is still not set. Count out when awake//
+			sleepers.fetch_add(1, std::memory_order_seq_cst);
+			std::uint32_t const s = state.load(std::memory_order_seq_cst);
+			if (!(s & set_bit))
+				state.wait(s, std::memory_order_acquire);
+			sleepers.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	// true => we got the event, false => timed out//
+	template <typename Rep, typename Period>
+	bool wait_for(std::chrono::duration<Rep, Period> timeout) {
+		auto const deadline = std::chrono::steady_clock::now() + timeout;
+		if (spin())
+			return true;
+		std::unique_lock<std::mutex> lk(timed_mut);
+		timed_waiters.fetch_add(1, std::memory_order_seq_cst);
+		bool const got = timed_cond.wait_until(lk, deadline, [this] {return try_take(); });
+		timed_waiters.fetch_sub(1, std::memory_order_relaxed);
+		return got;
+	}
+};
+
+/*
+	So wait_for_flag() from BLK1 becomes:
+
+		event flag_event;
+		void wait_for_flag() { flag_event.wait(); }
+		// and whoever used to set flag = true under m calls flag_event.set()
+
+	Below: the wake up latency benchmark.
+	The main thread signals, and we measure how long it takes until the waiter is running again.
+	Between two rounds the main thread sleeps 1 ms, so the waiter really is asleep ( no cheating with spinning ).
+*/
+using latency_clock = std::chrono::steady_clock;
+
+template <typename Signal, typename Wait>
+void measure_wakeup(char const* name, int rounds, Signal signal, Wait wait) {
+	std::vector<latency_clock::time_point> t0(rounds), t1(rounds);
+	std::thread waiter([&]() {
+		for (int i = 0; i < rounds; ++i) {
+			wait(i);
+			t1[i] = latency_clock::now();
+		}
+	});
+	for (int i = 0; i < rounds; ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		t0[i] = latency_clock::now();
+		signal(i);
+	}
+	waiter.join();
+
+	std::vector<double> us(rounds);
+	for (int i = 0; i < rounds; ++i) {
+		us[i] = std::chrono::duration<double, std::micro>(t1[i] - t0[i]).count();
+	}
+	std::sort(us.begin(), us.end());
+	std::cout << name << "\tp50 " << us[rounds / 2] << " us\tp99 " << us[(rounds * 99) / 100] << " us\n";
+}
+
+int main() {
+	// 1. The BLK1 way: a flag under a mutex, checked every 100 ms. Only 20 rounds, it is slow on purpose//
+	{
+		int flag_round = -1;
+		std::mutex m;
+		measure_wakeup("sleep polling    ", 20,
+			[&](int i) {
+				std::lock_guard<std::mutex> lk(m);
+				flag_round = i;
+			},
+			[&](int i) {
+				std::unique_lock<std::mutex> lk(m);
+				while (flag_round < i)
+				{
+					lk.unlock();
+					std::this_thread::sleep_for(std::chrono::milliseconds(100));
+					lk.lock();
+				}
+			});
+	}
+	// 2. The BLK2 way: condition_variable//
+	{
+		int flag_round = -1;
+		std::mutex mut;
+		std::condition_variable data_cond;
+		measure_wakeup("condition_variable", 500,
+			[&](int i) {
+				{
+					std::lock_guard<std::mutex> lk(mut);
+					flag_round = i;
+				}
+				data_cond.notify_one();
+			},
+			[&](int i) {
+				std::unique_lock<std::mutex> lk(mut);
+				data_cond.wait(lk, [&] {return flag_round >= i; });
+			});
+	}
+	// 3. One one_shot event per round//
+	{
+		std::vector<event> events(500);
+		measure_wakeup("event one_shot    ", 500,
+			[&](int i) {events[i].set(); },
+			[&](int i) {events[i].wait(); });
+	}
+	// 4. A single auto_reset event for every round ( the 1 ms gap means no set() is ever lost )//
+	{
+		event turnstile(event::mode::auto_reset);
+		measure_wakeup("event auto_reset  ", 500,
+			[&](int) {turnstile.set(); },
+			[&](int) {turnstile.wait(); });
+	}
+	// 5. wait_for: the timeout path, and the signalled path//
+	{
+		event e;
+		bool const timed_out = !e.wait_for(std::chrono::milliseconds(5));
+		std::thread setter([&e]() {e.set(); });
+		bool const got = e.wait_for(std::chrono::seconds(5));
+		setter.join();
+		std::cout << "wait_for timed out when nobody set it: " << std::boolalpha << timed_out
+			<< ", got it when somebody did: " << got << std::endl;
+	}
+}
+
+#endif // BLK8
+
+
+
+#ifdef BLK9
+/*
+	Back to BLK2 once more, and count the copies of one data_chunk:
+		data_chunk const data = prepare_data();		=> a brand new chunk, its buffer is a malloc
+		data_queue.push(data);							=> data is const, so this is a COPY ( malloc + memcpy )
+		data_chunk data = data_queue.front();			=> and another COPY on the way out ( malloc + memcpy )
+	For an int that is nothing. For a 64 KB buffer it is two deep copies and three mallocs per chunk,
+	and the frees happen on the consumer thread, far away from the producer that did the malloc.
+
+	Pool mode:
+		1. every producer owns a chunk_pool: slabs of ready made chunks, buffers already allocated
+		2. the producer takes a chunk from its pool, fills it in place, and pushes a chunk_ptr ( a pointer ) by move
+		3. the consumer processes it, and when its chunk_ptr dies the chunk goes back to the pool it came from
+	Nothing is copied. Once the pools are full size, the chunks don't allocate either: what is left in the benchmark
+	is std::queue's own blocks ( one per 64 pointers ) and the std::thread objects of the run.
+
+	Giving back happens on the consumer thread, but the free list belongs to the producer.
+	So returns land on a separate lock-free stack, and the owner takes the WHOLE stack with one exchange when its
+	own free list runs dry. ( Only the owner ever pops, so no ABA problem )
+	When both are empty, the pool grows by one more slab, up to max_slabs.
+	After that acquire() WAITS for a chunk to come back: a slow consumer slows the producer down ( backpressure ),
+	instead of the pool growing with the backlog.
+	A pool has to outlive every chunk it handed out.
+*/
+constexpr std::size_t payload_size = 64 * 1024;
+
+std::atomic<std::size_t> allocations{ 0 };
+std::atomic<std::size_t> bytes_copied{ 0 };
+
+void* operator new(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+struct data_chunk {
+	int id = 0;
+	bool last = false;
+	std::vector<unsigned char> payload;
+
+	data_chunk() = default;
+	// The copies are what we are counting//
+	data_chunk(data_chunk const& other) : id(other.id), last(other.last), payload(other.payload) {
+		bytes_copied.fetch_add(payload.size(), std::memory_order_relaxed);
+	}
+	data_chunk& operator=(data_chunk const& other) {
+		id = other.id;
+		last = other.last;
+		payload = other.payload;
+		bytes_copied.fetch_add(payload.size(), std::memory_order_relaxed);
+		return *this;
+	}
+	data_chunk(data_chunk&&) noexcept = default;
+	data_chunk& operator=(data_chunk&&) noexcept = default;
+};
+
+class chunk_pool;
+struct pool_slot;
+
+// A chunk on loan from a pool. Move only, like unique_ptr, and the deleter is "give it back"//
+class chunk_ptr {
+	friend class chunk_pool;
+	pool_slot* s = nullptr;
+	explicit chunk_ptr(pool_slot* p) : s(p) {}
+public:
+	chunk_ptr() = default;
+	chunk_ptr(chunk_ptr&& other) noexcept : s(std::exchange(other.s, nullptr)) {}
+	chunk_ptr& operator=(chunk_ptr&& other) noexcept {
+		if (this != &other) {
+			reset();
+			s = std::exchange(other.s, nullptr);
+		}
+		return *this;
+	}
+	~chunk_ptr() { reset(); }
+	void reset();
+	data_chunk& operator*() const;
+	data_chunk* operator->() const { return &**this; }
+};
+
+struct pool_slot {
+	data_chunk chunk;
+	chunk_pool* owner = nullptr;
+	pool_slot* next = nullptr;
+};
+
+class chunk_pool {
+	std::vector<std::unique_ptr<pool_slot[]>> slabs;
+	std::size_t const slab_size;
+	std::size_t const max_slabs;
+	// Owner thread only//
+	pool_slot* free_list = nullptr;
+	// Anybody pushes, only the owner takes ( all of it at once )//
+	alignas(64) std::atomic<pool_slot*> returned{ nullptr };
+	// The owner is asleep in acquire(), waiting for a give_back//
+	std::atomic<bool> owner_waiting{ false };
+
+	void grow() {
+		slabs.push_back(std::make_unique<pool_slot[]>(slab_size));
+		pool_slot* const slab = slabs.back().get();
+		for (std::size_t i = 0; i < slab_size; ++i) {
+			slab[i].chunk.payload.resize(payload_size);
+			slab[i].owner = this;
+			slab[i].next = free_list;
+			free_list = &slab[i];
+		}
+	}
+public:
+	explicit chunk_pool(std::size_t chunks_per_slab = 64, std::size_t slab_limit = 4)
+		: slab_size(chunks_per_slab), max_slabs(std::max<std::size_t>(slab_limit, 1)) {
+		grow();
+	}
+	chunk_pool(chunk_pool const&) = delete;
+	chunk_pool& operator=(chunk_pool const&) = delete;
+
+	// Called by the owner ( producer ) thread only//
+	chunk_ptr acquire() {
+		if (!free_list)
+			free_list = returned.exchange(nullptr, std::memory_order_acquire);
+		if (!free_list && slabs.size() < max_slabs)
+			grow();
+		if (!free_list) {
+			// Full size: wait for the consumer. seq_cst pairs with give_back, one of us sees the other//
+			owner_waiting.store(true, std::memory_order_seq_cst);
+			while (!(free_list = returned.exchange(nullptr, std::memory_order_seq_cst))) {
+				returned.wait(nullptr, std::memory_order_acquire);
+			}
+			owner_waiting.store(false, std::memory_order_relaxed);
+		}
+		pool_slot* const s = std::exchange(free_list, free_list->next);
+		return chunk_ptr(s);
+	}
+
+	// Called from any thread//
+	void give_back(pool_slot* s) noexcept {
+		s->next = returned.load(std::memory_order_relaxed);
+		while (!returned.compare_exchange_weak(s->next, s, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+		}
+		if (owner_waiting.load(std::memory_order_seq_cst))
+			returned.notify_one();
+	}
+
+	std::size_t capacity() const { return slabs.size() * slab_size; }
+};
+
+inline void chunk_ptr::reset() {
+	if (pool_slot* const p = std::exchange(s, nullptr))
+		p->owner->give_back(p);
+}
+inline data_chunk& chunk_ptr::operator*() const { return s->chunk; }
+
+// BLK2's queue, holding whatever T is: a whole data_chunk, or just a chunk_ptr//
+template <typename T>
+class chunk_queue {
+	std::mutex mut;
+	std::queue<T> data_queue;
+	std::condition_variable data_cond;
+public:
+	void push(T&& value) {
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			data_queue.push(std::move(value));
+		}
+		data_cond.notify_one();
+	}
+	// Copy in, exactly like BLK2: data_queue.push(data) with a const data//
+	void push(T const& value) {
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			data_queue.push(value);
+		}
+		data_cond.notify_one();
+	}
+	// Copy out, exactly like BLK2: data_chunk data = data_queue.front()//
+	T pop_copy() {
+		std::unique_lock<std::mutex> lk(mut);
+		data_cond.wait(lk, [this] {return !data_queue.empty(); });
+		T data = data_queue.front();
+		data_queue.pop();
+		return data;
+	}
+	T pop() {
+		std::unique_lock<std::mutex> lk(mut);
+		data_cond.wait(lk, [this] {return !data_queue.empty(); });
+		T data = std::move(data_queue.front());
+		data_queue.pop();
+		return data;
+	}
+};
+
+constexpr int producers = 2;
+constexpr int chunks_per_producer = 5000;
+
+void fill(data_chunk& data, int id, bool last) {
+	data.id = id;
+	data.last = last;
+	std::fill(data.payload.begin(), data.payload.end(), static_cast<unsigned char>(id));
+}
+
+// BLK2's prepare_data(): a fresh chunk every time//
+data_chunk prepare_data(int id, bool last) {
+	data_chunk data;
+	data.payload.resize(payload_size);
+	fill(data, id, last);
+	return data;
+}
+
+long long process(data_chunk const& data) {
+	return data.id + data.payload[data.payload.size() / 2];
+}
+
+struct run_stats {
+	long long sum;
+	double ms;
+	std::size_t allocations;
+	std::size_t bytes_copied;
+};
+
+template <typename Producer, typename Consumer>
+run_stats run(Producer producer, Consumer consumer) {
+	std::size_t const allocs_before = allocations.load();
+	std::size_t const copied_before = bytes_copied.load();
+	auto start = std::chrono::steady_clock::now();
+	long long sum = 0;
+	std::vector<std::thread> thread_vec{};
+	for (int p = 0; p < producers; ++p) {
+		thread_vec.push_back(std::thread(producer, p));
+	}
+	thread_vec.push_back(std::thread(consumer, std::ref(sum)));
+	for (std::thread& t : thread_vec) {
+		t.join();
+	}
+	std::chrono::duration<double, std::milli> const ms = std::chrono::steady_clock::now() - start;
+	return { sum, ms.count(), allocations.load() - allocs_before, bytes_copied.load() - copied_before };
+}
+
+int main() {
+	// 1. BLK2 as written: a new chunk per prepare_data(), copied in, copied out//
+	chunk_queue<data_chunk> copy_queue;
+	run_stats const copied = run(
+		[&copy_queue](int p) {
+			for (int i = 0; i < chunks_per_producer; ++i) {
+				data_chunk const data = prepare_data(p * chunks_per_producer + i, i == chunks_per_producer - 1);
+				copy_queue.push(data);
+			}
+		},
+		[&copy_queue](long long& sum) {
+			for (int lasts = 0; lasts < producers; ) {
+				data_chunk data = copy_queue.pop_copy();
+				sum += process(data);
+				lasts += data.last;
+			}
+		});
+
+	// 2. Pool mode: one pool per producer, chunks travel as chunk_ptr//
+	std::vector<std::unique_ptr<chunk_pool>> pools;
+	for (int p = 0; p < producers; ++p) {
+		pools.push_back(std::make_unique<chunk_pool>());
+	}
+	chunk_queue<chunk_ptr> ptr_queue;
+	auto pool_producer = [&](int p) {
+		for (int i = 0; i < chunks_per_producer; ++i) {
+			chunk_ptr data = pools[p]->acquire();
+			fill(*data, p * chunks_per_producer + i, i == chunks_per_producer - 1);
+			ptr_queue.push(std::move(data));
+		}
+	};
+	auto pool_consumer = [&](long long& sum) {
+		for (int lasts = 0; lasts < producers; ) {
+			chunk_ptr data = ptr_queue.pop();
+			sum += process(*data);
+			lasts += data->last;
+			// data goes back to its producer's pool right here//
+		}
+	};
+	auto pool_capacity = [&pools]() {
+		std::size_t capacity = 0;
+		for (auto const& pool : pools) {
+			capacity += pool->capacity();
+		}
+		return capacity;
+	};
+	// First run warms the pools up, the second one is the steady state//
+	run_stats const warmup = run(pool_producer, pool_consumer);
+	std::size_t const warm_capacity = pool_capacity();
+	run_stats const pooled = run(pool_producer, pool_consumer);
+
+	std::size_t const chunks = producers * chunks_per_producer;
+	auto row = [chunks](char const* name, run_stats const& r) {
+		std::cout << name << "\tsum " << r.sum << "\t" << r.ms << " ms\t"
+			<< static_cast<double>(r.allocations) / chunks << " allocations/chunk\t"
+			<< r.bytes_copied / chunks << " bytes copied/chunk\n";
+	};
+	std::cout << chunks << " chunks of " << payload_size << " bytes, " << producers << " producers, 1 consumer\n";
+	row("copy ( BLK2 )   ", copied);
+	row("pool, warm up   ", warmup);
+	row("pool, steady    ", pooled);
+	// max_slabs caps the pools: when the consumer falls behind, the producers wait instead of the pools growing//
+	std::cout << "chunks living in the pools: " << warm_capacity << " after warm up, " << pool_capacity()
+		<< " after the steady run" << std::endl;
+}
+
+#endif // BLK9
+
+
+
+#ifdef BLK10
+/*
+	BLK2's data_queue has no limit. If data_processing_thread() is slower than the producer, the queue just keeps
+	growing, until the OOM killer ends the discussion. And one consumer that stops on is_last_chunk() can't be
+	turned into four: only one of them would ever see the last chunk.
+
+	bounded_queue<T>(capacity, policy):
+		1. at most capacity items inside. When it is full, the producer either
+			block			=> waits for room ( backpressure: a slow consumer slows the producer down )
+			drop_newest		=> the new item is thrown away, push() says so
+			drop_oldest		=> the oldest item is thrown away to make room ( freshest data wins, e.g. quotes )
+		2. close() instead of the last chunk sentinel:
+			push() after close() fails, but pop() keeps handing out what is left ( drain ).
+			Once it is closed AND empty, pop() returns an empty optional, for EVERY consumer.
+		3. fair wake ups for N consumers:
+			a consumer that finds the queue empty queues up itself, with its own condition_variable.
+			push() hands the item straight to the consumer that has waited the longest, and wakes only that one.
+			No thundering herd, and no late comer stealing the item from somebody who has been waiting.
+			( A deli counter with tickets, instead of everybody rushing the counter when the bell rings )
+*/
+template <typename T>
+class bounded_queue {
+public:
+	enum class overflow { block, drop_newest, drop_oldest };
+	enum class push_status { pushed, dropped, closed };
+
+private:
+	// A consumer waiting for an item, lives on its own stack//
+	struct waiter {
+		std::optional<T> item;
+		bool done = false;
+		std::condition_variable cond;
+	};
+
+	std::mutex mut;
+	std::deque<T> data_queue;
+	std::deque<waiter*> waiters;
+	std::condition_variable not_full;
+	std::size_t const capacity;
+	overflow const policy;
+	bool closed = false;
+	std::size_t dropped_count = 0;
+	std::size_t high_water = 0;
+
+	// Called with mut held. Nobody is waiting => the queue is the only place for it//
+	void hand_over_or_store(T&& value) {
+		if (!waiters.empty()) {
+			waiter* const w = waiters.front();
+			waiters.pop_front();
+			w->item.emplace(std::move(value));
+			w->done = true;
+			// Under the lock: once done is seen, w may be gone//
+			w->cond.notify_one();
+			return;
+		}
+		data_queue.push_back(std::move(value));
+		high_water = std::max(high_water, data_queue.size());
+	}
+
+public:
+	explicit bounded_queue(std::size_t cap, overflow when_full = overflow::block)
+		: capacity(std::max<std::size_t>(cap, 1)), policy(when_full) {}
+	bounded_queue(bounded_queue const&) = delete;
+	bounded_queue& operator=(bounded_queue const&) = delete;
+
+	push_status push(T value) {
+		std::unique_lock<std::mutex> lk(mut);
+		if (closed)
+			return push_status::closed;
+		if (data_queue.size() >= capacity) {
+			if (policy == overflow::drop_newest) {
+				++dropped_count;
+				return push_status::dropped;
+			}
+			if (policy == overflow::drop_oldest) {
+				data_queue.pop_front();
+				++dropped_count;
+			}
+			else {
+				not_full.wait(lk, [this] {return data_queue.size() < capacity || closed; });
+				if (closed)
+					return push_status::closed;
+			}
+		}
+		hand_over_or_store(std::move(value));
+		return push_status::pushed;
+	}
+
+	// Empty optional => closed and nothing left//
+	std::optional<T> pop() {
+		std::unique_lock<std::mutex> lk(mut);
+		if (!data_queue.empty()) {
+			std::optional<T> value(std::move(data_queue.front()));
+			data_queue.pop_front();
+			lk.unlock();
+			not_full.notify_one();
+			return value;
+		}
+		if (closed)
+			return std::nullopt;
+		waiter w;
+		waiters.push_back(&w);
+		w.cond.wait(lk, [&w] {return w.done; });
+		// The item never touched data_queue, so there is no room to report//
+		return std::move(w.item);
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lk(mut);
+		closed = true;
+		// Only waiters left means the queue is empty: they all go home with nothing//
+		for (waiter* w : waiters) {
+			w->done = true;
+			w->cond.notify_one();
+		}
+		waiters.clear();
+		not_full.notify_all();
+	}
+
+	std::size_t dropped() {
+		std::lock_guard<std::mutex> lk(mut);
+		return dropped_count;
+	}
+	std::size_t max_size_seen() {
+		std::lock_guard<std::mutex> lk(mut);
+		return high_water;
+	}
+};
+
+struct data_chunk {
+	int id = 0;
+};
+
+// A consumer that is slower than the producers: ~2 us of work per chunk//
+void process(data_chunk const& data, long long& sum) {
+	auto const until = std::chrono::steady_clock::now() + std::chrono::microseconds(2);
+	while (std::chrono::steady_clock::now() < until) {
+	}
+	sum += data.id;
+}
+
+constexpr int producer_count = 2;
+constexpr int consumer_count = 4;
+constexpr int chunks_each = 20000;
+
+template <typename T>
+void report(char const* name, bounded_queue<T>& q, std::vector<long long> const& sums,
+	std::vector<int> const& taken, std::chrono::steady_clock::time_point start) {
+	auto dur = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	long long total = 0;
+	int processed = 0;
+	for (std::size_t c = 0; c < sums.size(); ++c) {
+		total += sums[c];
+		processed += taken[c];
+	}
+	std::cout << name << "\tprocessed " << processed << ", dropped " << q.dropped() << ", sum " << total
+		<< ", max queue length " << q.max_size_seen() << ", " << dur.count() << " ms, per consumer:";
+	for (int n : taken) {
+		std::cout << " " << n;
+	}
+	std::cout << std::endl;
+}
+
+void run_pipeline(char const* name, std::size_t capacity, bounded_queue<data_chunk>::overflow policy) {
+	bounded_queue<data_chunk> data_queue(capacity, policy);
+	std::vector<long long> sums(consumer_count, 0);
+	std::vector<int> taken(consumer_count, 0);
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> consumers{};
+	for (int c = 0; c < consumer_count; ++c) {
+		consumers.push_back(std::thread([&, c]() {
+			// No is_last_chunk(): run until the queue is closed and drained//
+			while (std::optional<data_chunk> data = data_queue.pop()) {
+				process(*data, sums[c]);
+				++taken[c];
+			}
+		}));
+	}
+	std::vector<std::thread> producers{};
+	for (int p = 0; p < producer_count; ++p) {
+		producers.push_back(std::thread([&, p]() {
+			for (int i = 0; i < chunks_each; ++i) {
+				data_queue.push(data_chunk{ p * chunks_each + i });
+			}
+		}));
+	}
+	for (std::thread& t : producers) {
+		t.join();
+	}
+	// Every producer is done: whatever is still inside gets processed, then the consumers stop//
+	data_queue.close();
+	for (std::thread& t : consumers) {
+		t.join();
+	}
+	report(name, data_queue, sums, taken, start);
+}
+
+int main() {
+	std::cout << producer_count << " producers x " << chunks_each << " chunks, " << consumer_count << " consumers\n";
+	// "Unbounded": BLK2's behaviour, the queue takes everything the producers make//
+	run_pipeline("unbounded       ", static_cast<std::size_t>(-1), bounded_queue<data_chunk>::overflow::block);
+	run_pipeline("block, 64       ", 64, bounded_queue<data_chunk>::overflow::block);
+	run_pipeline("drop_newest, 64 ", 64, bounded_queue<data_chunk>::overflow::drop_newest);
+	run_pipeline("drop_oldest, 64 ", 64, bounded_queue<data_chunk>::overflow::drop_oldest);
+
+	// After close(): push fails, the leftovers still come out, then the empty optional//
+	bounded_queue<int> q(4);
+	q.push(1);
+	q.push(2);
+	q.close();
+	bool const rejected = q.push(3) == bounded_queue<int>::push_status::closed;
+	std::cout << "push after close rejected: " << std::boolalpha << rejected << ", drained:";
+	while (std::optional<int> v = q.pop()) {
+		std::cout << " " << *v;
+	}
+	std::cout << std::endl;
+}
+
+#endif // BLK10
@@ -89,6 +89,9 @@ int main() {
 	std::atomic made those 3 steps happens in the atomic way.
 		So no threads will be accessing the variable while one thread is doing the three steps.
 		So there is no data race.
+
+	But all three threads are still fighting for the same cache line on every x_int++.
+	11.Sharded_counter.cpp spreads the counter over one cache line per thread, and measures the difference.
 */
 
 
@@ -203,6 +206,7 @@ int main() {
 
 		std::atomic<type>::is_lock_free() will check the objects is lock free.
 			( or is_always_lock_free() )
+		( A big struct is not lock free, 17.Read_mostly_locks.cpp BLK3 reads one without a lock: seqlock<T> )
 
 */
 
@@ -399,6 +403,8 @@ int main() {
 		load operations can have  memory_order_relaxed, memory_order_consume, memory_order_acquire, or memory_order_seq_cst
 		read modify write can have memory_order_relaxed, memory_order_consume, memory_order_acquire, memory_order_release, memory_order_acq_rel, or memory_order_seq_cst
 
+		What do they cost? 12.Atomic_memory_order_benchmark.cpp measures fetch_add and the CAS loop under each ordering.
+
 
 
 */
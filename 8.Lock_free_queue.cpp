@@ -0,0 +1,335 @@
+#include <thread>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <condition_variable>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+/*
+	Back in 6.Sharing_data_between_threads.cpp BLK2 we had the classic producer/consumer:
+		one std::mutex mut
+		one std::queue<data_chunk> data_queue
+		one std::condition_variable data_cond
+
+	Every push pays for a lock + a notify_one(), every pop pays for a lock too.
+	With a lot of producers and consumers, everybody is lining up for that one mutex.
+	( Like the one washroom in the rental place again, but now there are 16 roommates )
+
+	In the atomic note (7.Atomic_and_multi_threading.cpp) I said the hardcore option is lock-free programming.
+	This note is the first real lock-free data structure: a bounded MPMC ring buffer.
+		MPMC => multi producers, multi consumers.
+		Bounded => the capacity is fixed at construction ( power of 2 ), no allocation after that.
+
+	The design is the well known one from Dmitry Vyukov.
+*/
+
+// Bounded lock-free MPMC ring buffer //
+#define BLK1
+
+// Benchmark against the mutex + condition_variable version ( needs BLK1 ) //
+#define BLK2
+
+
+#ifdef BLK1
+/*
+	How does it work?
+
+	Every cell in the ring has a sequence number next to the data.
+		cell[i].sequence == pos			=> the cell is empty, and waiting for the producer who got ticket pos
+		cell[i].sequence == pos + 1		=> the cell is full, and waiting for the consumer who got ticket pos
+
+	Producers fight over enqueue_pos with compare_exchange_weak, consumers fight over dequeue_pos.
+	The winner of the CAS owns the cell, writes ( or reads ) the data, and then bumps the sequence to hand
+	the cell to the other side.
+	Nobody ever holds a lock, so if a thread is descheduled in the middle, the others just keep going on the
+	other cells.
+
+	False sharing:
+		enqueue_pos and dequeue_pos are written by different groups of threads.
+		If they sit on the same cache line, every push invalidates the line for the consumers and the other way around.
+		So each of them gets its own cache line ( alignas(cache_line_size) ).
+*/
+
+// std::hardware_destructive_interference_size exists, but gcc warns every time you use it in a header-ish way.//
+// 64 bytes is the cache line size on pretty much every x86 and ARM machine we run on.//
+constexpr std::size_t cache_line_size = 64;
+
+// The pause instruction tells the CPU "I am spinning", so it won't hammer the memory bus and
+// the sibling hyper thread gets the execution units.//
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+template <typename T>
+class mpmc_queue {
+	struct alignas(cache_line_size) cell {
+		std::atomic<std::size_t> sequence;
+		T data;
+	};
+
+	std::unique_ptr<cell[]> buffer;
+	std::size_t const mask;
+
+	alignas(cache_line_size) std::atomic<std::size_t> enqueue_pos{ 0 };
+	alignas(cache_line_size) std::atomic<std::size_t> dequeue_pos{ 0 };
+
+	// Parking lot: only touched when somebody ran out of spins//
+	// *_seq is the value the sleepers wait() on, *_parked tells the other side whether notify is needed at all//
+	alignas(cache_line_size) std::atomic<unsigned> push_seq{ 0 };
+	std::atomic<bool> pop_parked{ false };
+	alignas(cache_line_size) std::atomic<unsigned> pop_seq{ 0 };
+	std::atomic<bool> push_parked{ false };
+
+	static constexpr int spin_limit = 64;
+
+	// After a successful push ( or pop ), wake the other side if (and only if) somebody is parked//
+	// exchange() makes sure only one waker pays for the notify syscall per parking round//
+	void wake(std::atomic<unsigned>& seq, std::atomic<bool>& parked) {
+		// Pairs with the fence in park(): either the sleeper sees our data, or we see the sleeper//
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (parked.load(std::memory_order_relaxed) && parked.exchange(false, std::memory_order_relaxed)) {
+			seq.fetch_add(1, std::memory_order_release);
+			seq.notify_all();
+		}
+	}
+
+	// Read the sequence first, then raise the flag, then try one more time before sleeping.//
+	// If a waker bumps seq after we read it, wait() returns right away, so nothing gets lost.//
+	template <typename Try>
+	void park(std::atomic<unsigned>& seq, std::atomic<bool>& parked, Try try_once) {
+		for (;;) {
+			unsigned const seen = seq.load(std::memory_order_acquire);
+			parked.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (try_once())
+				return;
+			seq.wait(seen, std::memory_order_acquire);
+		}
+	}
+
+public:
+	// capacity must be a power of 2, so the index is just pos & mask//
+	explicit mpmc_queue(std::size_t capacity)
+		: buffer(new cell[capacity]), mask(capacity - 1) {
+		if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+			throw std::invalid_argument("mpmc_queue capacity must be a power of 2");
+		}
+		for (std::size_t i = 0; i < capacity; ++i) {
+			buffer[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	// Not copyable, not moveable, just like the mutex it replaces//
+	mpmc_queue(mpmc_queue const&) = delete;
+	mpmc_queue& operator=(mpmc_queue const&) = delete;
+
+	std::size_t capacity() const { return mask + 1; }
+
+	// Returns false right away when the queue is full//
+	template <typename U>
+	bool try_push(U&& value) {
+		cell* c;
+		std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			c = &buffer[pos & mask];
+			std::size_t const seq = c->sequence.load(std::memory_order_acquire);
+			auto const diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+			if (diff == 0) {
+				// The cell is free for ticket pos, try to take the ticket//
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) {
+				// The consumer of the previous lap hasn't freed this cell => full//
+				return false;
+			}
+			else {
+				// Another producer took the ticket, reload and try again//
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		c->data = std::forward<U>(value);
+		// Hand the cell to the consumer that will get ticket pos//
+		c->sequence.store(pos + 1, std::memory_order_release);
+		wake(push_seq, pop_parked);
+		return true;
+	}
+
+	// Returns false right away when the queue is empty//
+	bool try_pop(T& out) {
+		cell* c;
+		std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			c = &buffer[pos & mask];
+			std::size_t const seq = c->sequence.load(std::memory_order_acquire);
+			auto const diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+			if (diff == 0) {
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) {
+				// Nobody published into this cell yet => empty//
+				return false;
+			}
+			else {
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		out = std::move(c->data);
+		// Free the cell for the producer of the next lap//
+		c->sequence.store(pos + mask + 1, std::memory_order_release);
+		wake(pop_seq, push_parked);
+		return true;
+	}
+
+	/*
+		Blocking versions.
+			1. spin for a little while with the pause instruction ( cheap when the other side is fast )
+			2. then park on an atomic with C++20 wait() ( a futex on linux ), so we don't burn a core
+		This is the same job data_cond.wait() did for us, but only the slow path goes to the kernel.
+	*/
+	template <typename U>
+	void push(U&& value) {
+		// try_push only moves from value after it won a cell, so forwarding it in a loop is safe//
+		for (int i = 0; i < spin_limit; ++i) {
+			if (try_push(std::forward<U>(value)))
+				return;
+			cpu_relax();
+		}
+		park(pop_seq, push_parked, [&] {return try_push(std::forward<U>(value)); });
+	}
+
+	void pop(T& out) {
+		for (int i = 0; i < spin_limit; ++i) {
+			if (try_pop(out))
+				return;
+			cpu_relax();
+		}
+		park(push_seq, pop_parked, [&] {return try_pop(out); });
+	}
+};
+
+/*
+	So the drop-in for 6.Sharing_data_between_threads.cpp BLK2 looks like:
+
+		mpmc_queue<data_chunk> data_queue(1024);
+
+		void data_preparation_thread() {
+			while (more_data_to_prepare())
+				data_queue.push(prepare_data());		// no mut, no data_cond//
+		}
+		void data_processing_thread() {
+			while (true) {
+				data_chunk data;
+				data_queue.pop(data);
+				process(data);
+				if (is_last_chunk(data))
+					break;
+			}
+		}
+
+	Be aware:
+		1. It is bounded. When the consumers are slow, push() blocks instead of growing the memory.
+		2. T has to be default constructible and move assignable, because the cells hold a T all the time.
+		3. FIFO order holds per producer, but with many producers "first" is whoever won the CAS.
+*/
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	Benchmark:
+		N producer/consumer pairs, every producer pushes items_per_producer chunks,
+		every consumer pops the same amount, so there is no need for a "last chunk" here.
+
+	Version A: the mut/data_cond/data_queue code from 6.Sharing_data_between_threads.cpp BLK2
+	Version B: mpmc_queue from BLK1
+*/
+struct data_chunk {
+	int id = 0;
+	double payload[3]{};
+};
+
+constexpr int items_per_producer = 200000;
+
+struct locked_queue {
+	std::mutex mut;
+	std::queue<data_chunk> data_queue;
+	std::condition_variable data_cond;
+
+	void push(data_chunk const& data) {
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			data_queue.push(data);
+		}
+		data_cond.notify_one();
+	}
+	void pop(data_chunk& out) {
+		std::unique_lock<std::mutex> lk(mut);
+		data_cond.wait(lk, [this] {return !data_queue.empty(); });
+		out = data_queue.front();
+		data_queue.pop();
+	}
+};
+
+template <typename Queue>
+double run_pairs(Queue& q, int pairs) {
+	std::atomic<long long> checksum{ 0 };
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+	for (int p = 0; p < pairs; ++p) {
+		threads.emplace_back([&q, p]() {
+			for (int i = 0; i < items_per_producer; ++i) {
+				data_chunk data;
+				data.id = p * items_per_producer + i;
+				q.push(data);
+			}
+		});
+		threads.emplace_back([&q, &checksum]() {
+			long long local = 0;
+			for (int i = 0; i < items_per_producer; ++i) {
+				data_chunk data;
+				q.pop(data);
+				local += data.id;
+			}
+			checksum += local;
+		});
+	}
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	auto end = std::chrono::steady_clock::now();
+	// Every id was pushed once and popped once, otherwise the queue is broken//
+	long long const n = static_cast<long long>(pairs) * items_per_producer;
+	if (checksum != n * (n - 1) / 2) {
+		std::cerr << "checksum mismatch!!!\n";
+	}
+	return std::chrono::duration<double>(end - start).count();
+}
+
+int main() {
+	std::cout << "pairs\tmutex+cv (Mops/s)\tmpmc (Mops/s)\n";
+	for (int pairs : {1, 2, 4, 8, 16}) {
+		double const ops = static_cast<double>(pairs) * items_per_producer;
+		locked_queue lq;
+		double const t_locked = run_pairs(lq, pairs);
+		mpmc_queue<data_chunk> mq(1024);
+		double const t_mpmc = run_pairs(mq, pairs);
+		std::cout << pairs << "\t" << ops / t_locked / 1e6 << "\t\t\t" << ops / t_mpmc / 1e6 << "\n";
+	}
+}
+
+#endif // BLK2
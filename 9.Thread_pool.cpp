@@ -0,0 +1,922 @@
+#include <thread>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <future>
+#include <functional>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <type_traits>
+#include <numeric>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <optional>
+#include <variant>
+#include <exception>
+/*
+	In 6.Sharing_data_between_threads.cpp BLK4, the note said std::packaged_task<> "can be used as a building block
+	for thread pools". But the demo still launched a brand new std::thread for every packaged_task.
+
+	Creating a thread is not free:
+		the kernel has to create it, allocate a stack ( 8 MB of address space on linux ), schedule it, and tear it down.
+	For a task that runs for a few microseconds, that fixed cost is bigger than the task itself.
+
+	A thread pool keeps a fixed set of worker threads alive, and hands them tasks.
+	( Like a restaurant does not hire a new cook for every order )
+
+	This note builds a work-stealing pool:
+		1. every worker owns a Chase-Lev deque of tasks
+		2. the owner pushes and pops at the bottom ( LIFO, hot in cache ), with no CAS in the common case
+		3. idle workers steal from the top of a random victim's deque ( FIFO, the oldest and usually biggest task )
+		4. submit(callable, args...) wraps the call in a packaged_task and returns the std::future, like std::async
+*/
+
+// Chase-Lev deque and the work-stealing pool //
+#define BLK1
+
+// The accum demo from 6.Sharing_data_between_threads.cpp BLK4 on the pool ( needs BLK1 ) //
+//#define BLK2
+
+// parallel_reduce, the two-way accum split for any number of cores ( needs BLK1 ) //
+//#define BLK3
+
+// pool_future: then / when_all / when_any continuations instead of blocking get() ( needs BLK1 ) //
+#define BLK4
+
+
+#ifdef BLK1
+/*
+	Chase-Lev deque ( "Dynamic Circular Work-Stealing Deque", with the C11 memory orders from Le et al. 2013 )
+
+	bottom => only the owner writes it
+	top    => thieves ( and the owner, for the last element ) race on it with CAS
+
+	The tricky part is the last element: the owner and a thief may both go for it.
+	Both sides use a seq_cst fence, then whoever wins the CAS on top gets it.
+
+	When the ring is full, the owner grows it into a bigger array.
+	The old array can still be read by a thief that loaded the pointer before the swap,
+	so we keep the old arrays alive until the deque dies. ( no fancy memory reclamation needed )
+*/
+template <typename T>
+class chase_lev_deque {
+	struct ring {
+		std::int64_t const size;
+		std::unique_ptr<std::atomic<T*>[]> slots;
+		explicit ring(std::int64_t n) : size(n), slots(new std::atomic<T*>[n]) {}
+		T* get(std::int64_t i) const { return slots[i & (size - 1)].load(std::memory_order_relaxed); }
+		void put(std::int64_t i, T* x) { slots[i & (size - 1)].store(x, std::memory_order_relaxed); }
+	};
+
+	alignas(64) std::atomic<std::int64_t> top{ 0 };
+	alignas(64) std::atomic<std::int64_t> bottom{ 0 };
+	alignas(64) std::atomic<ring*> array;
+	// Every ring we ever used, the current one is the last//
+	std::vector<std::unique_ptr<ring>> rings;
+
+	ring* grow(ring* a, std::int64_t b, std::int64_t t) {
+		auto bigger = std::make_unique<ring>(a->size * 2);
+		for (std::int64_t i = t; i < b; ++i) {
+			bigger->put(i, a->get(i));
+		}
+		ring* const raw = bigger.get();
+		rings.push_back(std::move(bigger));
+		array.store(raw, std::memory_order_release);
+		return raw;
+	}
+
+public:
+	explicit chase_lev_deque(std::int64_t capacity = 256) {
+		rings.push_back(std::make_unique<ring>(capacity));
+		array.store(rings.back().get(), std::memory_order_relaxed);
+	}
+	chase_lev_deque(chase_lev_deque const&) = delete;
+	chase_lev_deque& operator=(chase_lev_deque const&) = delete;
+
+	// Owner only//
+	void push(T* x) {
+		std::int64_t const b = bottom.load(std::memory_order_relaxed);
+		std::int64_t const t = top.load(std::memory_order_acquire);
+		ring* a = array.load(std::memory_order_relaxed);
+		if (b - t > a->size - 1) {
+			a = grow(a, b, t);
+		}
+		a->put(b, x);
+		// Release: a thief that sees the new bottom also sees the task ( and everything written into it )//
+		bottom.store(b + 1, std::memory_order_release);
+	}
+
+	// Owner only, takes the newest task//
+	T* pop() {
+		std::int64_t const b = bottom.load(std::memory_order_relaxed) - 1;
+		ring* const a = array.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t t = top.load(std::memory_order_relaxed);
+		T* x = nullptr;
+		if (t <= b) {
+			x = a->get(b);
+			if (t == b) {
+				// The last one, race the thieves for it//
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					x = nullptr;
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+		}
+		else {
+			// It was empty, put bottom back//
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return x;
+	}
+
+	// Any thread, takes the oldest task. nullptr when empty or when another thief won//
+	T* steal() {
+		std::int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t const b = bottom.load(std::memory_order_acquire);
+		if (t < b) {
+			ring* const a = array.load(std::memory_order_acquire);
+			T* const x = a->get(t);
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				return nullptr;
+			return x;
+		}
+		return nullptr;
+	}
+};
+
+
+/*
+	The task type.
+	std::function<void()> needs a copyable callable, but std::packaged_task is move only ( like std::thread ).
+	So we do the type erasure by hand with a tiny virtual base.
+*/
+struct pool_task {
+	virtual ~pool_task() = default;
+	virtual void run() = 0;
+};
+
+template <typename R>
+struct packaged_pool_task : pool_task {
+	std::packaged_task<R()> pt;
+	explicit packaged_pool_task(std::packaged_task<R()> p) : pt(std::move(p)) {}
+	// Any exception thrown by the callable ends up in the future, same as BLK5 of the note 6//
+	void run() override { pt(); }
+};
+
+// Fire and forget, no future. The callable must not throw ( nobody would catch it )//
+template <typename F>
+struct callable_pool_task : pool_task {
+	F f;
+	explicit callable_pool_task(F fn) : f(std::move(fn)) {}
+	void run() override { f(); }
+};
+
+
+class work_stealing_pool {
+	struct worker {
+		chase_lev_deque<pool_task> tasks;
+	};
+
+	std::vector<std::unique_ptr<worker>> workers;
+	std::vector<std::thread> threads;
+
+	// Tasks submitted from outside the pool can't go into a Chase-Lev deque ( push is owner only )//
+	// So they go into this one, a plain mutex protected queue//
+	std::mutex inject_mut;
+	std::deque<pool_task*> injected;
+
+	// Parking: same idea as mpmc_queue in 8.Lock_free_queue.cpp//
+	alignas(64) std::atomic<unsigned> wake_seq{ 0 };
+	std::atomic<int> sleepers{ 0 };
+	std::atomic<bool> stopping{ false };
+
+	// Which pool and which worker the current thread is, so submit() from inside a task stays local//
+	static thread_local work_stealing_pool* current_pool;
+	static thread_local std::size_t current_index;
+
+	void push(pool_task* t) {
+		if (current_pool == this) {
+			workers[current_index]->tasks.push(t);
+		}
+		else {
+			std::lock_guard<std::mutex> lk(inject_mut);
+			injected.push_back(t);
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleepers.load(std::memory_order_relaxed) > 0) {
+			wake_seq.fetch_add(1, std::memory_order_release);
+			wake_seq.notify_one();
+		}
+	}
+
+	pool_task* pop_injected() {
+		std::lock_guard<std::mutex> lk(inject_mut);
+		if (injected.empty())
+			return nullptr;
+		pool_task* t = injected.front();
+		injected.pop_front();
+		return t;
+	}
+
+	// Own deque first, then the injection queue, then steal from random victims//
+	pool_task* find_task(std::size_t self, std::minstd_rand& rng) {
+		if (self < workers.size()) {
+			if (pool_task* t = workers[self]->tasks.pop())
+				return t;
+		}
+		if (pool_task* t = pop_injected())
+			return t;
+		std::size_t const n = workers.size();
+		std::size_t const start = rng() % n;
+		for (std::size_t i = 0; i < n; ++i) {
+			std::size_t const victim = (start + i) % n;
+			if (victim == self)
+				continue;
+			if (pool_task* t = workers[victim]->tasks.steal())
+				return t;
+		}
+		return nullptr;
+	}
+
+	static void execute(pool_task* t) {
+		std::unique_ptr<pool_task> owned(t);
+		owned->run();
+	}
+
+	void worker_loop(std::size_t index) {
+		current_pool = this;
+		current_index = index;
+		std::minstd_rand rng(static_cast<unsigned>(index) + 1);
+		for (;;) {
+			pool_task* t = find_task(index, rng);
+			if (!t) {
+				// Nothing to do. Announce we are going to sleep, look once more, then park.//
+				unsigned const seen = wake_seq.load(std::memory_order_acquire);
+				sleepers.fetch_add(1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				t = find_task(index, rng);
+				if (!t) {
+					// Only leave when the pool is shutting down AND there is nothing left to run//
+					if (stopping.load(std::memory_order_acquire)) {
+						sleepers.fetch_sub(1, std::memory_order_relaxed);
+						return;
+					}
+					wake_seq.wait(seen, std::memory_order_acquire);
+				}
+				sleepers.fetch_sub(1, std::memory_order_relaxed);
+			}
+			if (t)
+				execute(t);
+		}
+	}
+
+public:
+	// One worker per hardware thread. hardware_concurrency() may return 0 when it can't tell//
+	explicit work_stealing_pool(std::size_t worker_count = std::thread::hardware_concurrency()) {
+		if (worker_count == 0)
+			worker_count = 1;
+		for (std::size_t i = 0; i < worker_count; ++i) {
+			workers.push_back(std::make_unique<worker>());
+		}
+		for (std::size_t i = 0; i < worker_count; ++i) {
+			threads.emplace_back(&work_stealing_pool::worker_loop, this, i);
+		}
+	}
+
+	// Finish what was submitted, then join everybody ( no detached workers, see note 1 )//
+	~work_stealing_pool() {
+		stopping.store(true, std::memory_order_release);
+		wake_seq.fetch_add(1, std::memory_order_release);
+		wake_seq.notify_all();
+		for (std::thread& t : threads) {
+			t.join();
+		}
+	}
+	work_stealing_pool(work_stealing_pool const&) = delete;
+	work_stealing_pool& operator=(work_stealing_pool const&) = delete;
+
+	std::size_t size() const { return threads.size(); }
+
+	/*
+		Same calling convention as std::thread and std::async:
+			arguments are copied ( decayed ) into the task, use std::ref() if you want a reference.
+	*/
+	template <typename F, typename... Args>
+	auto submit(F&& f, Args&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+		using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+		std::packaged_task<R()> pt(
+			[fn = std::forward<F>(f), tup = std::make_tuple(std::forward<Args>(args)...)]() mutable -> R {
+				return std::apply(std::move(fn), std::move(tup));
+			});
+		std::future<R> fut = pt.get_future();
+		push(new packaged_pool_task<R>(std::move(pt)));
+		return fut;
+	}
+
+	// Like submit(), without the packaged_task and the future. For continuations that report their own result//
+	template <typename F>
+	void post(F&& f) {
+		push(new callable_pool_task<std::decay_t<F>>(std::forward<F>(f)));
+	}
+
+	bool is_worker_thread() const { return current_pool == this; }
+
+	/*
+		Run one pending task on the calling thread, if there is any.
+		Useful when a thread would otherwise block on a future: help the pool instead of sleeping.
+	*/
+	bool run_pending_task() {
+		thread_local std::minstd_rand rng(std::random_device{}());
+		std::size_t const self = current_pool == this ? current_index : workers.size();
+		if (pool_task* t = find_task(self, rng)) {
+			execute(t);
+			return true;
+		}
+		return false;
+	}
+};
+
+thread_local work_stealing_pool* work_stealing_pool::current_pool = nullptr;
+thread_local std::size_t work_stealing_pool::current_index = 0;
+
+#endif // BLK1
+
+
+
+#ifdef BLK2
+/*
+	The same accum from 6.Sharing_data_between_threads.cpp BLK4.
+	Before:
+		std::packaged_task<double(double*, double*, double)> pt1(accum);
+		auto f1 = pt1.get_future();
+		std::thread t1(std::move(pt1), first, half, 0.0);
+		...
+		t1.join();
+	Now:
+		auto f1 = pool.submit(accum, first, half, 0.0);
+	No thread to create, nothing to join. The pool owns the threads.
+*/
+double accum(double* beg, double* end, double init) {
+	return  std::accumulate(beg, end, init);
+}
+
+int main() {
+	work_stealing_pool pool;
+	std::vector<double> vec(10000000, 0.5);
+	double* first = &vec[0];
+	double* half = first + vec.size() / 2;
+	double* last = first + vec.size();
+
+	auto f1 = pool.submit(accum, first, half, 0.0);
+	auto f2 = pool.submit(accum, half, last, 0.0);
+	double result = f1.get() + f2.get();
+	std::cout << "The value of result is: " << result << std::endl;
+
+	/*
+		Where the pool pays off: lots of short tasks.
+		A thread + packaged_task per task, vs one submit() per task.
+	*/
+	constexpr int task_count = 20000;
+	auto tiny = [](int i) {return i * 2; };
+
+	auto start = std::chrono::steady_clock::now();
+	long long sum_threads = 0;
+	for (int i = 0; i < task_count; ++i) {
+		std::packaged_task<int(int)> pt(tiny);
+		auto f = pt.get_future();
+		std::thread t(std::move(pt), i);
+		sum_threads += f.get();
+		t.join();
+	}
+	auto mid = std::chrono::steady_clock::now();
+	std::vector<std::future<int>> futures;
+	futures.reserve(task_count);
+	for (int i = 0; i < task_count; ++i) {
+		futures.push_back(pool.submit(tiny, i));
+	}
+	long long sum_pool = 0;
+	for (auto& f : futures) {
+		sum_pool += f.get();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	auto us = [](auto d) {return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+	std::cout << task_count << " tiny tasks, thread per task: " << us(mid - start) << " us (sum " << sum_threads << ")\n";
+	std::cout << task_count << " tiny tasks, pool.submit():   " << us(end - mid) << " us (sum " << sum_pool << ")\n";
+	std::cout << "workers in the pool: " << pool.size() << std::endl;
+}
+
+#endif // BLK2
+
+
+
+#ifdef BLK3
+/*
+	The accum demo splits the vector into exactly two halves. On a 64 core box, 62 cores watch.
+	parallel_reduce(first, last, init, op) generalises it:
+
+	1. Chunking
+		chunk count = 4 x workers ( a few extra chunks so a slow worker doesn't hold everybody back )
+		but a chunk is never smaller than min_chunk elements, small inputs just run on the calling thread.
+		You can also pass chunk_size yourself.
+
+	2. Non-commutative ops
+		Every chunk folds its own elements from left to right, starting from its FIRST ELEMENT ( not from init ),
+		so op doesn't need an identity value.
+		The chunk results are then folded in chunk order: op(op(op(init, r0), r1), r2)...
+		So op only has to be associative ( string concat, matrix multiply are fine ), not commutative.
+
+	3. Floating point
+		a + (b + c) != (a + b) + c for doubles, so the answer depends on where the chunk borders are.
+		The borders only depend on the size of the input and chunk_size ( NOT on which worker ran what, or when ),
+		and the final fold always goes in chunk order. Same input + same chunk_size => the same bits, every run.
+		If you need the same bits on machines with different core counts, pass chunk_size explicitly.
+
+	4. Threads
+		The work runs on a work_stealing_pool that lives for the whole program, nobody creates threads per call.
+		The calling thread helps run chunks instead of just sleeping on the futures.
+*/
+
+// The pool every parallel_reduce call shares, created on first use ( thread safe since C++11 )//
+work_stealing_pool& default_pool() {
+	static work_stealing_pool pool;
+	return pool;
+}
+
+template <typename It, typename T, typename Op>
+T parallel_reduce(work_stealing_pool& pool, It first, It last, T init, Op op, std::size_t chunk_size = 0) {
+	constexpr std::size_t min_chunk = 16384;
+	std::size_t const n = static_cast<std::size_t>(std::distance(first, last));
+	if (chunk_size == 0) {
+		std::size_t const max_chunks = pool.size() * 4;
+		chunk_size = std::max(min_chunk, (n + max_chunks - 1) / max_chunks);
+	}
+	if (n <= chunk_size) {
+		return std::accumulate(first, last, std::move(init), op);
+	}
+
+	// The chunk worker: fold [beg, end) starting from *beg//
+	auto fold_chunk = [op](It beg, It end) {
+		T acc = *beg;
+		for (++beg; beg != end; ++beg) {
+			acc = op(std::move(acc), *beg);
+		}
+		return acc;
+	};
+
+	std::vector<std::future<T>> partials;
+	partials.reserve((n + chunk_size - 1) / chunk_size);
+	for (std::size_t offset = 0; offset < n; offset += chunk_size) {
+		It const beg = std::next(first, static_cast<std::ptrdiff_t>(offset));
+		It const end = std::next(beg, static_cast<std::ptrdiff_t>(std::min(chunk_size, n - offset)));
+		partials.push_back(pool.submit(fold_chunk, beg, end));
+	}
+
+	// Help the pool while the results are not ready, then fold in chunk order//
+	T result = std::move(init);
+	for (std::future<T>& f : partials) {
+		while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready && pool.run_pending_task()) {
+		}
+		result = op(std::move(result), f.get());
+	}
+	return result;
+}
+
+template <typename It, typename T, typename Op>
+T parallel_reduce(It first, It last, T init, Op op, std::size_t chunk_size = 0) {
+	return parallel_reduce(default_pool(), first, last, std::move(init), std::move(op), chunk_size);
+}
+
+int main() {
+	std::vector<double> vec(10000000, 0.5);
+	// Some ugly numbers so the rounding actually depends on the order//
+	for (std::size_t i = 0; i < vec.size(); i += 7) {
+		vec[i] = 1.0 / static_cast<double>(i + 3);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	double const serial = std::accumulate(vec.begin(), vec.end(), 0.0);
+	auto mid = std::chrono::steady_clock::now();
+	double const parallel = parallel_reduce(vec.begin(), vec.end(), 0.0, std::plus<double>());
+	auto end = std::chrono::steady_clock::now();
+	double const again = parallel_reduce(vec.begin(), vec.end(), 0.0, std::plus<double>());
+
+	auto ms = [](auto d) {return std::chrono::duration_cast<std::chrono::milliseconds>(d).count(); };
+	std::cout.precision(17);
+	std::cout << "serial accumulate: " << serial << " in " << ms(mid - start) << " ms\n";
+	std::cout << "parallel_reduce:   " << parallel << " in " << ms(end - mid) << " ms on "
+		<< default_pool().size() << " workers\n";
+	std::cout << "same bits on the second run? " << std::boolalpha << (parallel == again) << "\n";
+
+	// Non-commutative: string concatenation must keep the order//
+	std::vector<std::string> words(100000);
+	for (std::size_t i = 0; i < words.size(); ++i) {
+		words[i] = std::string(1, static_cast<char>('a' + i % 26));
+	}
+	std::string const joined = parallel_reduce(words.begin(), words.end(), std::string(">"),
+		[](std::string a, std::string const& b) {return a += b; }, 1000);
+	std::string const expected = std::accumulate(words.begin(), words.end(), std::string(">"));
+	std::cout << "string concat keeps the order? " << (joined == expected) << std::endl;
+}
+
+#endif // BLK3
+
+
+
+#ifdef BLK4
+/*
+	6.Sharing_data_between_threads.cpp BLK3 and BLK5: the only thing you can do with a std::future is get() or wait().
+	Somebody has to sit on it. So "when f1 is ready, do X with it" costs a whole thread that does nothing but wait,
+	with its 8 MB stack, for every pending result.
+
+	pool_future<T> turns it around: instead of waiting for the value, you tell it what to do with the value.
+		f.then(g)			=> when f is ready, g(value) runs on the pool, and you get a pool_future of g's result
+		when_all(fs)		=> ready when all of them are, with all the values ( in order )
+		when_any(fs)		=> ready when the first one is, with its index and value
+	Nobody waits. The continuation is just a task that gets pushed to the pool by whoever sets the value.
+
+	Producers:
+		pool_async(pool, f, args...)	=> like std::async / pool.submit
+		pool_promise<T>					=> same interface as std::promise ( set_value, set_exception, get_future ),
+										   so the promise code from note 6 BLK5 works with either one.
+	Exceptions travel the same way as with std::future: a failed future skips the .then() functions and
+	get() at the end of the chain rethrows it.
+*/
+template <typename T>
+class pool_future;
+
+template <typename T>
+class pool_promise;
+
+namespace future_detail {
+	// void can't be stored, std::monostate takes its place//
+	template <typename T>
+	using stored_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+	template <typename T>
+	class state {
+		std::mutex m;
+		std::optional<stored_t<T>> value;
+		std::exception_ptr error;
+		std::vector<std::unique_ptr<pool_task>> continuations;
+		std::atomic<bool> ready{ false };
+
+		void finish(std::unique_lock<std::mutex>& lk) {
+			if (ready.load(std::memory_order_relaxed))
+				throw std::future_error(std::future_errc::promise_already_satisfied);
+			ready.store(true, std::memory_order_release);
+			std::vector<std::unique_ptr<pool_task>> todo = std::move(continuations);
+			lk.unlock();
+			ready.notify_all();
+			for (auto& t : todo) {
+				pool.post([t = std::move(t)]() {t->run(); });
+			}
+		}
+
+	public:
+		work_stealing_pool& pool;
+		explicit state(work_stealing_pool& p) : pool(p) {}
+
+		void set_value(stored_t<T> v) {
+			std::unique_lock<std::mutex> lk(m);
+			if (!ready.load(std::memory_order_relaxed))
+				value.emplace(std::move(v));
+			finish(lk);
+		}
+		void set_exception(std::exception_ptr e) {
+			std::unique_lock<std::mutex> lk(m);
+			if (!ready.load(std::memory_order_relaxed))
+				error = std::move(e);
+			finish(lk);
+		}
+
+		bool is_ready() const { return ready.load(std::memory_order_acquire); }
+
+		// Runs f on the pool once the state is ready ( right away if it already is )//
+		template <typename F>
+		void on_ready(F f) {
+			auto task = std::make_unique<callable_pool_task<F>>(std::move(f));
+			{
+				std::lock_guard<std::mutex> lk(m);
+				if (!ready.load(std::memory_order_relaxed)) {
+					continuations.push_back(std::move(task));
+					return;
+				}
+			}
+			pool.post([t = std::move(task)]() {t->run(); });
+		}
+
+		/*
+			A worker thread that waits could be waiting for a task sitting in its own deque.
+			So on a worker: keep running other tasks. Anywhere else: help a bit, then sleep on the flag.
+		*/
+		void wait() {
+			while (!ready.load(std::memory_order_acquire)) {
+				if (pool.run_pending_task())
+					continue;
+				if (pool.is_worker_thread())
+					std::this_thread::yield();
+				else
+					ready.wait(false, std::memory_order_acquire);
+			}
+		}
+
+		// Only after wait() or on_ready(), when nobody writes anymore//
+		std::exception_ptr failure() const { return error; }
+		stored_t<T>& stored() { return *value; }
+	};
+
+	// Set the state from the result of f(args...), void or not, value or exception//
+	template <typename T, typename F, typename... Args>
+	void fulfil(state<T>& s, F&& f, Args&&... args) {
+		try {
+			if constexpr (std::is_void_v<T>) {
+				std::invoke(std::forward<F>(f), std::forward<Args>(args)...);
+				s.set_value(std::monostate{});
+			}
+			else {
+				s.set_value(std::invoke(std::forward<F>(f), std::forward<Args>(args)...));
+			}
+		}
+		catch (...) {
+			s.set_exception(std::current_exception());
+		}
+	}
+}
+
+template <typename T>
+class pool_future {
+	template <typename U> friend class pool_future;
+	template <typename U> friend class pool_promise;
+	template <typename F, typename... Args> friend auto pool_async(work_stealing_pool&, F&&, Args&&...);
+	template <typename U> friend pool_future<std::vector<U>> when_all(std::vector<pool_future<U>>);
+	template <typename U> friend pool_future<std::pair<std::size_t, U>> when_any(std::vector<pool_future<U>>);
+
+	std::shared_ptr<future_detail::state<T>> st;
+	explicit pool_future(std::shared_ptr<future_detail::state<T>> s) : st(std::move(s)) {}
+
+public:
+	pool_future() = default;
+	pool_future(pool_future&&) = default;
+	pool_future& operator=(pool_future&&) = default;
+	pool_future(pool_future const&) = delete;
+	pool_future& operator=(pool_future const&) = delete;
+
+	bool valid() const { return st != nullptr; }
+	bool is_ready() const { return st->is_ready(); }
+	void wait() const { st->wait(); }
+
+	// Like std::future::get(): once, and it rethrows what the producer threw//
+	T get() {
+		std::shared_ptr<future_detail::state<T>> s = std::move(st);
+		s->wait();
+		if (s->failure())
+			std::rethrow_exception(s->failure());
+		if constexpr (!std::is_void_v<T>)
+			return std::move(s->stored());
+	}
+
+	/*
+		g(value) ( or g() for pool_future<void> ) runs on the pool when this one is ready.
+		This future is used up, like get() would.
+	*/
+	template <typename F>
+	auto then(F g) {
+		using R = std::conditional_t<std::is_void_v<T>, std::invoke_result<F>, std::invoke_result<F, T>>::type;
+		std::shared_ptr<future_detail::state<T>> src = std::move(st);
+		auto dst = std::make_shared<future_detail::state<R>>(src->pool);
+		src->on_ready([src, dst, g = std::move(g)]() mutable {
+			if (src->failure()) {
+				dst->set_exception(src->failure());
+			}
+			else if constexpr (std::is_void_v<T>) {
+				future_detail::fulfil(*dst, std::move(g));
+			}
+			else {
+				future_detail::fulfil(*dst, std::move(g), std::move(src->stored()));
+			}
+		});
+		return pool_future<R>(std::move(dst));
+	}
+};
+
+template <typename T>
+class pool_promise {
+	std::shared_ptr<future_detail::state<T>> st;
+	bool future_taken = false;
+	bool satisfied = false;
+public:
+	explicit pool_promise(work_stealing_pool& pool) : st(std::make_shared<future_detail::state<T>>(pool)) {}
+	pool_promise(pool_promise&&) = default;
+	pool_promise& operator=(pool_promise&&) = default;
+	// Same as std::promise: dying without a value leaves a broken_promise in the future//
+	~pool_promise() {
+		if (st && !satisfied)
+			st->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+	}
+
+	pool_future<T> get_future() {
+		if (future_taken)
+			throw std::future_error(std::future_errc::future_already_retrieved);
+		future_taken = true;
+		return pool_future<T>(st);
+	}
+
+	template <typename U = T>
+	void set_value(U&& v) requires (!std::is_void_v<T>) {
+		st->set_value(std::forward<U>(v));
+		satisfied = true;
+	}
+	void set_value() requires std::is_void_v<T> {
+		st->set_value(std::monostate{});
+		satisfied = true;
+	}
+	void set_exception(std::exception_ptr e) {
+		st->set_exception(std::move(e));
+		satisfied = true;
+	}
+};
+
+template <typename F, typename... Args>
+auto pool_async(work_stealing_pool& pool, F&& f, Args&&... args) {
+	using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+	auto s = std::make_shared<future_detail::state<R>>(pool);
+	pool.post([s, fn = std::forward<F>(f), tup = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+		future_detail::fulfil(*s, [&]() -> R {return std::apply(std::move(fn), std::move(tup)); });
+	});
+	return pool_future<R>(std::move(s));
+}
+
+// All the values, in the order of the input. If any of them failed, the first failure ( by position ) is rethrown//
+template <typename T>
+pool_future<std::vector<T>> when_all(std::vector<pool_future<T>> fs) {
+	static_assert(!std::is_void_v<T>, "when_all of pool_future<void> has no values to collect");
+	struct gather {
+		std::vector<std::shared_ptr<future_detail::state<T>>> inputs;
+		std::atomic<std::size_t> remaining;
+		std::shared_ptr<future_detail::state<std::vector<T>>> out;
+	};
+	if (fs.empty())
+		throw std::invalid_argument("when_all of nothing");
+	auto g = std::make_shared<gather>();
+	g->remaining.store(fs.size(), std::memory_order_relaxed);
+	g->out = std::make_shared<future_detail::state<std::vector<T>>>(fs.front().st->pool);
+	for (pool_future<T>& f : fs) {
+		g->inputs.push_back(std::move(f.st));
+	}
+	for (auto& input : g->inputs) {
+		input->on_ready([g]() {
+			// The last one to arrive builds the result//
+			if (g->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+			std::vector<T> values;
+			values.reserve(g->inputs.size());
+			for (auto& in : g->inputs) {
+				if (in->failure()) {
+					g->out->set_exception(in->failure());
+					return;
+				}
+				values.push_back(std::move(in->stored()));
+			}
+			g->out->set_value(std::move(values));
+		});
+	}
+	return pool_future<std::vector<T>>(g->out);
+}
+
+// The first one to be ready wins, value or exception. The others still run, their results are dropped//
+template <typename T>
+pool_future<std::pair<std::size_t, T>> when_any(std::vector<pool_future<T>> fs) {
+	static_assert(!std::is_void_v<T>, "use the index of when_any on pool_future<int> or similar");
+	if (fs.empty())
+		throw std::invalid_argument("when_any of nothing");
+	auto won = std::make_shared<std::atomic<bool>>(false);
+	auto out = std::make_shared<future_detail::state<std::pair<std::size_t, T>>>(fs.front().st->pool);
+	for (std::size_t i = 0; i < fs.size(); ++i) {
+		std::shared_ptr<future_detail::state<T>> in = std::move(fs[i].st);
+		in->on_ready([in, i, won, out]() {
+			if (won->exchange(true, std::memory_order_acq_rel))
+				return;
+			if (in->failure())
+				out->set_exception(in->failure());
+			else
+				out->set_value(std::make_pair(i, std::move(in->stored())));
+		});
+	}
+	return pool_future<std::pair<std::size_t, T>>(out);
+}
+
+/*
+	Y from note 6 BLK3 ( the functor f3 and f4 were made with ), and accum + task from note 6 BLK5.
+	task() is a template now, so the same producer code fills a std::promise or a pool_promise.
+*/
+struct Y
+{
+	double operator()(double d) { return d * 2; }
+};
+
+double accum(double* beg, double* end, double init) {
+	return  std::accumulate(beg, end, init);
+}
+
+template <typename Promise>
+void task(Promise& p, double* beg, double* end, double init) {
+	p.set_value(accum(beg, end, init));
+}
+
+int main() {
+	work_stealing_pool pool;
+
+	// f3 from note 6 BLK3, with a continuation instead of f3.get()//
+	pool_future<std::string> f3 = pool_async(pool, Y(), 3.141)
+		.then([](double d) {return d + 1; })
+		.then([](double d) {return "Y()(3.141) + 1 = " + std::to_string(d); });
+	std::cout << f3.get() << "\n";
+
+	// Note 6 BLK5: two threads fill two promises. Nobody waits for them one by one, when_all adds them up//
+	std::vector<double> vec(10000000, 0.5);
+	double* first = &vec[0];
+	double* half = first + vec.size() / 2;
+	double* last = first + vec.size();
+	pool_promise<double> p1(pool), p2(pool);
+	std::vector<pool_future<double>> halves;
+	halves.push_back(p1.get_future());
+	halves.push_back(p2.get_future());
+	pool_future<double> total = when_all(std::move(halves)).then([](std::vector<double> v) {return v[0] + v[1]; });
+	std::thread t1(task<pool_promise<double>>, std::ref(p1), first, half, 0.0);
+	std::thread t2(task<pool_promise<double>>, std::ref(p2), half, last, 0.0);
+	std::cout << "Task Value = " << total.get() << std::endl;
+	t1.join();
+	t2.join();
+
+	// when_any: the fastest of three replicas answers//
+	std::vector<pool_future<int>> replicas;
+	for (int i = 0; i < 3; ++i) {
+		replicas.push_back(pool_async(pool, [i]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(30 - 10 * i));
+			return i * 100;
+		}));
+	}
+	auto [index, answer] = when_any(std::move(replicas)).get();
+	std::cout << "replica " << index << " answered first: " << answer << "\n";
+
+	// An exception skips the rest of the chain and comes out of get()//
+	pool_future<int> broken = pool_async(pool, []() -> int {throw std::runtime_error("Surprise!!!!!!"); })
+		.then([](int v) {std::cout << "never printed\n"; return v; });
+	try {
+		broken.get();
+	}
+	catch (std::exception const& ex) {
+		std::cout << "chain failed with: " << ex.what() << "\n";
+	}
+
+	/*
+		The waste we started with: 1000 results, each needs a follow-up step.
+			blocking:		a thread per result, parked in std::future::get()
+			continuations:	a .then() per result, no thread at all until the value is there
+	*/
+	constexpr int pending = 1000;
+	auto ms = [](auto d) {return std::chrono::duration<double, std::milli>(d).count(); };
+	{
+		std::vector<std::promise<int>> promises(pending);
+		std::atomic<long long> sum{ 0 };
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> waiters;
+		for (auto& p : promises) {
+			waiters.emplace_back([f = p.get_future(), &sum]() mutable {sum += f.get() * 2; });
+		}
+		for (int i = 0; i < pending; ++i) {
+			promises[i].set_value(i);
+		}
+		for (std::thread& t : waiters) {
+			t.join();
+		}
+		std::cout << pending << " blocked waiters:  " << pending << " threads, " << ms(std::chrono::steady_clock::now() - start)
+			<< " ms, sum " << sum << "\n";
+	}
+	{
+		std::vector<pool_promise<int>> promises;
+		std::vector<pool_future<long long>> followups;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < pending; ++i) {
+			promises.emplace_back(pool);
+			followups.push_back(promises.back().get_future().then([](int v) {return v * 2LL; }));
+		}
+		for (int i = 0; i < pending; ++i) {
+			promises[i].set_value(i);
+		}
+		std::vector<long long> values = when_all(std::move(followups)).get();
+		std::cout << pending << " continuations:    0 threads, " << ms(std::chrono::steady_clock::now() - start)
+			<< " ms, sum " << std::accumulate(values.begin(), values.end(), 0LL) << std::endl;
+	}
+}
+
+#endif // BLK4